@@ -2,6 +2,20 @@
 
 #include "subprocess/basic_types.hpp"
 #include "subprocess/pipe.hpp"
+#include "subprocess/PinnedBuffer.hpp"
+#include "subprocess/OutputSink.hpp"
+#include "subprocess/SpillCapture.hpp"
+#include "subprocess/MemoryCapture.hpp"
+#include "subprocess/Broadcast.hpp"
+#include "subprocess/Sharder.hpp"
+#include "subprocess/MergedOutput.hpp"
+#include "subprocess/InterleavedCapture.hpp"
+#include "subprocess/Expect.hpp"
+#include "subprocess/ShmChannel.hpp"
+#include "subprocess/FramedChannel.hpp"
+#include "subprocess/Digest.hpp"
+#include "subprocess/Transform.hpp"
+#include "subprocess/Pipeline.hpp"
 #include "subprocess/ProcessBuilder.hpp"
 #include "subprocess/shell_utils.hpp"
 #include "subprocess/environ.hpp"
\ No newline at end of file
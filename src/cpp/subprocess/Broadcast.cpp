@@ -0,0 +1,293 @@
+#include "Broadcast.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "pipe.hpp"
+#include "SigPipeGuard.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
+
+using namespace subprocess::details;
+
+namespace {
+    using subprocess::PipeHandle;
+    using subprocess::pipe_close;
+    using subprocess::pipe_write_all;
+
+    constexpr std::size_t kCopyChunk    = 64*1024;
+    // each child's pipe is its window, how far it may lag behind the others
+    constexpr int kPipeWindow           = 1024*1024;
+
+    /*  Blocking write of everything.
+        @return false if the pipe is broken.
+    */
+    bool write_all(PipeHandle handle, const char* data, std::size_t size) {
+        return pipe_write_all(handle, data, size) == size;
+    }
+
+    void close_target(std::vector<PipeHandle>& targets, std::size_t index) {
+        pipe_close(targets[index]);
+        targets.erase(targets.begin() + index);
+    }
+
+#ifndef _WIN32
+    /*  Nonblocking write of as much as the pipe takes. */
+    ssize_t write_some(PipeHandle handle, const char* data, std::size_t size) {
+#ifdef __linux__
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(data);
+        iov.iov_len  = size;
+        // no SPLICE_F_GIFT, the same pages go to every child
+        ssize_t transfered = vmsplice(handle, &iov, 1, SPLICE_F_NONBLOCK);
+        if (transfered >= 0 || (errno != EINVAL && errno != ENOSYS))
+            return transfered;
+#endif
+        return ::write(handle, data, size);
+    }
+#endif
+}
+
+namespace subprocess {
+    Broadcast::Broadcast(PinnedBuffer data) : mData(std::move(data)) {
+    }
+    Broadcast::Broadcast(std::string_view data) : mData(data) {
+    }
+    Broadcast::Broadcast(PipeHandle source) : mSource(source) {
+        if (source == kBadPipeValue)
+            throw std::invalid_argument("Broadcast: bad source handle");
+    }
+    Broadcast::~Broadcast() {
+        if (mThread.joinable())
+            mThread.join();
+        for (PipeHandle target : mTargets)
+            pipe_close(target);
+    }
+
+    void Broadcast::add(PipeHandle input) {
+        if (mStarted)
+            throw std::runtime_error("Broadcast: can't add children once started");
+        // children started later must not hold it open, it would never see EOF
+        pipe_set_inheritable(input, false);
+#ifdef F_SETPIPE_SZ
+        // best effort, limited by /proc/sys/fs/pipe-max-size
+        fcntl(input, F_SETPIPE_SZ, kPipeWindow);
+#endif
+        mTargets.push_back(input);
+    }
+
+    void Broadcast::start() {
+        if (mStarted)
+            throw std::runtime_error("Broadcast: already started");
+        mStarted = true;
+        mThread = std::thread([this]() { run(); });
+    }
+
+    void Broadcast::wait() {
+        if (mThread.joinable())
+            mThread.join();
+        if (mError) {
+            std::exception_ptr error = mError;
+            mError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void Broadcast::run() {
+        // a child that exits early must not kill the whole process
+        block_sigpipe_on_this_thread();
+        try {
+#ifdef _WIN32
+            run_copy();
+#else
+            if (mSource == kBadPipeValue)
+                run_memory();
+            else
+                run_tee();
+#endif
+        } catch (...) {
+            mError = std::current_exception();
+        }
+        for (PipeHandle target : mTargets)
+            pipe_close(target);
+        mTargets.clear();
+    }
+
+#ifdef _WIN32
+    void Broadcast::run_memory() {
+        run_copy();
+    }
+    void Broadcast::run_tee() {
+        run_copy();
+    }
+#else
+    void Broadcast::run_memory() {
+        const char* data = mData.data();
+        const std::size_t size = mData.size();
+        std::vector<std::size_t> offsets(mTargets.size(), 0);
+        for (PipeHandle target : mTargets)
+            pipe_set_nonblocking(target);
+
+        std::vector<PipePoll> entries;
+        while (!mTargets.empty()) {
+            entries.resize(mTargets.size());
+            for (std::size_t i = 0; i < mTargets.size(); ++i)
+                entries[i] = {mTargets[i], kPipeWritable};
+            pipe_poll(&entries[0], entries.size());
+
+            // backwards so closing a target doesn't shift the ones to come
+            for (std::size_t i = entries.size(); i-- > 0;) {
+                if (entries[i].ready == 0)
+                    continue;
+                std::size_t& offset = offsets[i];
+                if (offset < size) {
+                    ssize_t transfered = write_some(mTargets[i], data + offset, size - offset);
+                    if (transfered < 0 && (errno == EAGAIN || errno == EINTR))
+                        continue;
+                    if (transfered < 0 && errno != EPIPE)
+                        throw_os_error("write", errno);
+                    if (transfered > 0)
+                        offset += transfered;
+                    else
+                        offset = size;
+                }
+                if (offset >= size) {
+                    close_target(mTargets, i);
+                    offsets.erase(offsets.begin() + i);
+                }
+            }
+        }
+    }
+
+    void Broadcast::run_tee() {
+#ifndef __linux__
+        run_copy();
+#else
+        std::vector<char> buffer;
+        std::vector<std::size_t> sent;
+        std::vector<bool> broken;
+        while (!mTargets.empty()) {
+            PipePoll source = {mSource, kPipeReadable};
+            pipe_poll(&source, 1);
+            int available = 0;
+            if (ioctl(mSource, FIONREAD, &available) < 0)
+                available = 0;
+            if (available <= 0) {
+                if (source.ready & kPipeClosed)
+                    break;
+                // not a pipe, or plain end of file
+                run_copy();
+                return;
+            }
+            const std::size_t size = std::min<std::size_t>(available, kPipeWindow);
+
+            /*  tee() everyone but the last, which gets the data moved with
+                splice(). tee() always starts at the head of the source so a
+                partial tee can't be resumed, those children get the rest
+                from a copy instead.
+            */
+            const std::size_t last = mTargets.size() - 1;
+            sent.assign(mTargets.size(), 0);
+            broken.assign(mTargets.size(), false);
+            bool need_copy = false;
+            for (std::size_t i = 0; i < last; ++i) {
+                ssize_t transfered;
+                do {
+                    transfered = tee(mSource, mTargets[i], size, 0);
+                } while (transfered < 0 && errno == EINTR);
+                if (transfered < 0 && errno == EINVAL && i == 0) {
+                    run_copy();
+                    return;
+                }
+                if (transfered < 0 && errno != EPIPE)
+                    throw_os_error("tee", errno);
+                if (transfered < 0)
+                    broken[i] = true;
+                else
+                    sent[i] = transfered;
+                need_copy = need_copy || (!broken[i] && sent[i] < size);
+            }
+            std::size_t moved = 0;
+            while (!need_copy && moved < size) {
+                ssize_t transfered = splice(mSource, nullptr, mTargets[last],
+                    nullptr, size - moved, SPLICE_F_MOVE);
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+                if (transfered < 0 && errno == EPIPE) {
+                    broken[last] = true;
+                    break;
+                }
+                if (transfered < 0)
+                    throw_os_error("splice", errno);
+                if (transfered == 0)
+                    break;
+                moved += transfered;
+            }
+            sent[last] = moved;
+            if (moved < size) {
+                // the rest of the chunk, FIONREAD promised it so no blocking
+                buffer.resize(size - moved);
+                std::size_t pos = 0;
+                while (pos < buffer.size()) {
+                    ssize_t transfered = ::read(mSource, &buffer[pos], buffer.size() - pos);
+                    if (transfered < 0 && errno == EINTR)
+                        continue;
+                    if (transfered <= 0)
+                        throw_os_error("read", errno);
+                    pos += transfered;
+                }
+                // moved is 0 unless only the last one is missing data
+                for (std::size_t i = 0; i <= last; ++i) {
+                    if (broken[i] || sent[i] >= size)
+                        continue;
+                    if (!write_all(mTargets[i], &buffer[sent[i] - moved], size - sent[i]))
+                        broken[i] = true;
+                }
+            }
+            for (std::size_t i = mTargets.size(); i-- > 0;) {
+                if (broken[i])
+                    close_target(mTargets, i);
+            }
+        }
+#endif
+    }
+#endif
+
+    void Broadcast::run_copy() {
+        std::vector<char> buffer(kCopyChunk);
+        std::size_t pos = 0;
+        while (!mTargets.empty()) {
+            const char* chunk;
+            std::size_t size;
+            if (mSource == kBadPipeValue) {
+                if (pos >= mData.size())
+                    break;
+                chunk = mData.data() + pos;
+                size = std::min(kCopyChunk, mData.size() - pos);
+                pos += size;
+            } else {
+                ssize_t transfered = pipe_read(mSource, &buffer[0], buffer.size());
+#ifndef _WIN32
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+#endif
+                if (transfered <= 0)
+                    break;
+                chunk = &buffer[0];
+                size = transfered;
+            }
+            for (std::size_t i = mTargets.size(); i-- > 0;) {
+                if (!write_all(mTargets[i], chunk, size))
+                    close_target(mTargets, i);
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <exception>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "basic_types.hpp"
+#include "PinnedBuffer.hpp"
+
+namespace subprocess {
+    /** Feeds the same input to the cin of many children, reading the source
+        only once and with a single thread for all of them.
+
+        Pass the same broadcast as cin of every child, then call start():
+        @code
+            auto broadcast = std::make_shared<Broadcast>(snapshot);
+            Popen a({"tool_a"}, RunBuilder().cin(broadcast).cout(PipeOption::pipe));
+            Popen b({"tool_b"}, RunBuilder().cin(broadcast).cout(PipeOption::pipe));
+            broadcast->start();
+            CompletedProcess result_a = run(a);
+            CompletedProcess result_b = run(b);
+        @endcode
+
+        Data in memory is vmspliced into each child's pipe on linux, so the
+        pages are shared rather than copied. Every child keeps its own
+        position and is written to whenever its pipe has room, a slow
+        reader only delays itself.
+
+        A pipe source is duplicated into the children with tee() and
+        consumed once with splice(). All children advance together chunk by
+        chunk, each child's pipe is enlarged to act as its own window so a
+        briefly slow reader doesn't hold up the others. Nothing is buffered
+        beyond the pipes.
+
+        Elsewhere, or for sources that aren't pipes, it falls back to reading
+        chunks and writing them to each child in turn.
+
+        A child that exits or closes its cin is dropped, the others carry on.
+    */
+    class Broadcast {
+    public:
+        /** Broadcasts the buffer. */
+        explicit Broadcast(PinnedBuffer data);
+        /** Copies data once into a PinnedBuffer. */
+        explicit Broadcast(std::string_view data);
+        /** Reads source until end of file. The handle is not closed, it must
+            stay open until wait() returns.
+        */
+        explicit Broadcast(PipeHandle source);
+        /** Waits for the feeding to finish. Closes the cin of any children
+            if start() was never called.
+        */
+        ~Broadcast();
+        Broadcast(const Broadcast&)=delete;
+        Broadcast& operator=(const Broadcast&)=delete;
+
+        /** Adds a pipe to feed. Takes ownership and closes it once everything
+            was written. Popen calls this when the broadcast is used as cin.
+
+            @throw std::runtime_error if already started.
+        */
+        void add(PipeHandle input);
+        /** Starts feeding all added pipes on a background thread. */
+        void start();
+        /** Waits until all data was written or every child was dropped.
+
+            @throw the error that stopped the feeding if any, e.g. OSError
+                   reading the source.
+        */
+        void wait();
+    private:
+        void run();
+        void run_memory();
+        void run_tee();
+        void run_copy();
+
+        PinnedBuffer            mData;
+        PipeHandle              mSource = kBadPipeValue;
+        std::vector<PipeHandle> mTargets;
+        std::thread             mThread;
+        std::exception_ptr      mError;
+        bool                    mStarted = false;
+    };
+}
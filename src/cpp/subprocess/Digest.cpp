@@ -0,0 +1,231 @@
+#include "Digest.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define SUBPROCESS_SSE42 1
+#define SUBPROCESS_TARGET_SSE42
+#elif defined(__GNUC__) || defined(__clang__)
+#include <nmmintrin.h>
+#define SUBPROCESS_SSE42 1
+// compiled for sse4.2 regardless of -m flags, only called if the cpu has it
+#define SUBPROCESS_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+namespace {
+    // reflected Castagnoli polynomial
+    constexpr std::uint32_t kCrc32cPolynomial = 0x82F63B78;
+
+    /*  Slicing by 8: table[k][b] is the CRC of byte b followed by k zero
+        bytes, so 8 bytes are folded in with 8 independent lookups.
+    */
+    struct Crc32cTables {
+        std::uint32_t table[8][256];
+        Crc32cTables() {
+            for (std::uint32_t i = 0; i < 256; ++i) {
+                std::uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc >> 1) ^ (kCrc32cPolynomial & (0 - (crc & 1)));
+                table[0][i] = crc;
+            }
+            for (int k = 1; k < 8; ++k) {
+                for (int i = 0; i < 256; ++i) {
+                    std::uint32_t previous = table[k - 1][i];
+                    table[k][i] = (previous >> 8) ^ table[0][previous & 0xff];
+                }
+            }
+        }
+    };
+
+    const Crc32cTables& crc32c_tables() {
+        static const Crc32cTables tables;
+        return tables;
+    }
+
+    inline std::uint32_t load32(const unsigned char* p) {
+        return (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8)
+            | ((std::uint32_t)p[2] << 16) | ((std::uint32_t)p[3] << 24);
+    }
+    inline std::uint64_t load64(const unsigned char* p) {
+        return (std::uint64_t)load32(p) | ((std::uint64_t)load32(p + 4) << 32);
+    }
+
+    std::uint32_t crc32c_table(std::uint32_t crc, const unsigned char* p, std::size_t size) {
+        const auto& t = crc32c_tables().table;
+        for (; size >= 8; p += 8, size -= 8) {
+            std::uint32_t low = crc ^ load32(p);
+            crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff]
+                ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+                ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        }
+        for (; size > 0; ++p, --size)
+            crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+
+#ifdef SUBPROCESS_SSE42
+    SUBPROCESS_TARGET_SSE42
+    std::uint32_t crc32c_sse42(std::uint32_t crc, const unsigned char* p, std::size_t size) {
+#if defined(__x86_64__) || defined(_M_X64)
+        std::uint64_t crc64 = crc;
+        for (; size >= 32; p += 32, size -= 32) {
+            crc64 = _mm_crc32_u64(crc64, load64(p));
+            crc64 = _mm_crc32_u64(crc64, load64(p + 8));
+            crc64 = _mm_crc32_u64(crc64, load64(p + 16));
+            crc64 = _mm_crc32_u64(crc64, load64(p + 24));
+        }
+        for (; size >= 8; p += 8, size -= 8)
+            crc64 = _mm_crc32_u64(crc64, load64(p));
+        crc = (std::uint32_t)crc64;
+#else
+        for (; size >= 4; p += 4, size -= 4)
+            crc = _mm_crc32_u32(crc, load32(p));
+#endif
+        for (; size > 0; ++p, --size)
+            crc = _mm_crc32_u8(crc, *p);
+        return crc;
+    }
+
+    bool cpu_has_sse42() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+#endif
+
+    constexpr std::uint64_t kPrime1 = 11400714785074694791ULL;
+    constexpr std::uint64_t kPrime2 = 14029467366897019727ULL;
+    constexpr std::uint64_t kPrime3 = 1609587929392839161ULL;
+    constexpr std::uint64_t kPrime4 = 9650029242287828579ULL;
+    constexpr std::uint64_t kPrime5 = 2870177450012600261ULL;
+
+    inline std::uint64_t rotl(std::uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+    inline std::uint64_t xxh_round(std::uint64_t accumulator, std::uint64_t input) {
+        accumulator += input*kPrime2;
+        return rotl(accumulator, 31)*kPrime1;
+    }
+    inline std::uint64_t xxh_merge(std::uint64_t hash, std::uint64_t accumulator) {
+        hash ^= xxh_round(0, accumulator);
+        return hash*kPrime1 + kPrime4;
+    }
+    inline void xxh_stripe(std::uint64_t (&accumulators)[4], const unsigned char* p) {
+        accumulators[0] = xxh_round(accumulators[0], load64(p));
+        accumulators[1] = xxh_round(accumulators[1], load64(p + 8));
+        accumulators[2] = xxh_round(accumulators[2], load64(p + 16));
+        accumulators[3] = xxh_round(accumulators[3], load64(p + 24));
+    }
+}
+
+namespace subprocess {
+    namespace details {
+        bool crc32c_hardware() {
+#ifdef SUBPROCESS_SSE42
+            static const bool supported = cpu_has_sse42();
+            return supported;
+#else
+            return false;
+#endif
+        }
+
+        std::uint32_t crc32c(const void* data, std::size_t size, std::uint32_t crc, bool hardware) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            crc = ~crc;
+#ifdef SUBPROCESS_SSE42
+            if (hardware && crc32c_hardware())
+                return ~crc32c_sse42(crc, p, size);
+#endif
+            return ~crc32c_table(crc, p, size);
+        }
+    }
+
+    std::uint32_t crc32c(const void* data, std::size_t size, std::uint32_t crc) {
+        return details::crc32c(data, size, crc, true);
+    }
+
+    Xxh64::Xxh64(std::uint64_t seed) : mSeed(seed) {
+        mAccumulators[0] = seed + kPrime1 + kPrime2;
+        mAccumulators[1] = seed + kPrime2;
+        mAccumulators[2] = seed;
+        mAccumulators[3] = seed - kPrime1;
+    }
+
+    void Xxh64::update(const void* data, std::size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        mTotal += size;
+        if (mBuffered + size < 32) {
+            std::memcpy(mBuffer + mBuffered, p, size);
+            mBuffered += size;
+            return;
+        }
+        if (mBuffered > 0) {
+            std::size_t fill = 32 - mBuffered;
+            std::memcpy(mBuffer + mBuffered, p, fill);
+            xxh_stripe(mAccumulators, mBuffer);
+            p += fill;
+            size -= fill;
+            mBuffered = 0;
+        }
+        for (; size >= 32; p += 32, size -= 32)
+            xxh_stripe(mAccumulators, p);
+        std::memcpy(mBuffer, p, size);
+        mBuffered = size;
+    }
+
+    std::uint64_t Xxh64::digest() const {
+        std::uint64_t hash;
+        if (mTotal >= 32) {
+            hash = rotl(mAccumulators[0], 1) + rotl(mAccumulators[1], 7)
+                + rotl(mAccumulators[2], 12) + rotl(mAccumulators[3], 18);
+            for (std::uint64_t accumulator : mAccumulators)
+                hash = xxh_merge(hash, accumulator);
+        } else {
+            hash = mSeed + kPrime5;
+        }
+        hash += mTotal;
+
+        const unsigned char* p = mBuffer;
+        std::size_t size = mBuffered;
+        for (; size >= 8; p += 8, size -= 8) {
+            hash ^= xxh_round(0, load64(p));
+            hash = rotl(hash, 27)*kPrime1 + kPrime4;
+        }
+        if (size >= 4) {
+            hash ^= (std::uint64_t)load32(p)*kPrime1;
+            hash = rotl(hash, 23)*kPrime2 + kPrime3;
+            p += 4;
+            size -= 4;
+        }
+        for (; size > 0; ++p, --size) {
+            hash ^= *p*kPrime5;
+            hash = rotl(hash, 11)*kPrime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    OutputDigest StreamDigest::result() const {
+        OutputDigest digest;
+        digest.kinds = mKinds;
+        if (mKinds & kDigestCrc32c)
+            digest.crc32c = mCrc;
+        if (mKinds & kDigestXxh64)
+            digest.xxh64 = mXxh64.digest();
+        digest.size = mSize;
+        return digest;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "basic_types.hpp"
+
+namespace subprocess {
+    /** CRC32C (Castagnoli) of data, using the SSE4.2 crc32 instruction when
+        the cpu has it and a table otherwise.
+
+        @param crc  the CRC of the preceding data to continue from, so
+                    crc32c(b, crc32c(a)) == crc32c(a + b).
+    */
+    std::uint32_t crc32c(const void* data, std::size_t size, std::uint32_t crc = 0);
+    inline std::uint32_t crc32c(std::string_view data, std::uint32_t crc = 0) {
+        return crc32c(data.data(), data.size(), crc);
+    }
+
+    /** Streaming XXH64, a fast non-cryptographic 64 bit hash. Gives the
+        same value as the reference implementation however the data is
+        split across update() calls.
+    */
+    class Xxh64 {
+    public:
+        explicit Xxh64(std::uint64_t seed = 0);
+        void update(const void* data, std::size_t size);
+        void update(std::string_view data) { update(data.data(), data.size()); }
+        /** The hash of everything so far, more can still be added. */
+        std::uint64_t digest() const;
+    private:
+        std::uint64_t   mSeed;
+        std::uint64_t   mAccumulators[4];
+        std::uint64_t   mTotal          = 0;
+        unsigned char   mBuffer[32];
+        std::size_t     mBuffered       = 0;
+    };
+
+    /** Computes the OutputDigest kinds asked for over a stream of chunks,
+        as run() does for RunOptions::cout_digest & cerr_digest.
+    */
+    class StreamDigest {
+    public:
+        /** @param kinds   DigestKind flags. */
+        explicit StreamDigest(int kinds = 0) : mKinds(kinds) {}
+        void update(std::string_view chunk) {
+            if (mKinds & kDigestCrc32c)
+                mCrc = crc32c(chunk, mCrc);
+            if (mKinds & kDigestXxh64)
+                mXxh64.update(chunk);
+            mSize += chunk.size();
+        }
+        int kinds() const { return mKinds; }
+        OutputDigest result() const;
+    private:
+        int             mKinds;
+        std::uint32_t   mCrc    = 0;
+        Xxh64           mXxh64;
+        std::uint64_t   mSize   = 0;
+    };
+
+    /** @cond PRIVATE */
+    namespace details {
+        /** crc32c() forcing the table or the SSE4.2 version, for tests and
+            benchmarks. hardware falls back to the table if unsupported.
+        */
+        std::uint32_t crc32c(const void* data, std::size_t size, std::uint32_t crc, bool hardware);
+        bool crc32c_hardware();
+    }
+    /** @endcond */
+}
@@ -0,0 +1,101 @@
+#include "Expect.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+
+#include "PatternMatcher.hpp"
+#include "SigPipeGuard.hpp"
+
+namespace subprocess {
+    Expect::Expect(CommandLine command, RunOptions options) {
+        options.cin = PipeOption::pipe;
+        options.cout = PipeOption::pipe;
+        mPopen = Popen(command, std::move(options));
+    }
+
+    Expect::Expect(Popen&& popen) : mPopen(std::move(popen)) {
+        if (mPopen.cin == kBadPipeValue || mPopen.cout == kBadPipeValue)
+            throw std::invalid_argument("Expect: cin & cout must be pipes");
+    }
+
+    // out of line for the unique_ptr, ~Popen() closes the pipes and waits
+    Expect::~Expect() {
+    }
+
+    void Expect::send(std::string_view data) {
+        // a program that exited fails the write instead of killing us
+        details::SigPipeGuard guard;
+        if (pipe_write_all(mPopen.cin, data.data(), data.size()) < data.size()) {
+            details::throw_os_error("Expect::send", errno);
+            throw OSError("Expect::send failed");
+        }
+    }
+
+    void Expect::sendline(std::string_view line) {
+        send(line);
+        send("\n");
+    }
+
+    bool Expect::read_more(double deadline) {
+        PipePoll entry = {mPopen.cout, kPipeReadable};
+        if (pipe_poll(&entry, 1, deadline) == 0)
+            return false;
+        char buffer[16*1024];
+        ssize_t transfered = pipe_read(mPopen.cout, buffer, sizeof(buffer));
+#ifndef _WIN32
+        if (transfered < 0 && errno == EINTR)
+            return true;
+#endif
+        if (transfered <= 0)
+            mEof = true;
+        else
+            mBuffer.append(buffer, transfered);
+        return true;
+    }
+
+    Expect::Match Expect::expect(const std::vector<std::string>& patterns, double timeout) {
+        // forget what the previous match consumed
+        if (mConsumed > 0) {
+            mBuffer.erase(0, mConsumed);
+            mScanned -= mConsumed;
+            mConsumed = 0;
+        }
+        if (!mMatcher || patterns != mPatterns) {
+            mMatcher = std::make_unique<details::PatternMatcher>(patterns);
+            mPatterns = patterns;
+            mScanned = 0;
+        }
+        // after a timeout the scan resumes where it left off
+        if (mScanned == 0)
+            mMatcher->reset();
+
+        const double deadline = timeout < 0? -1 : monotonic_seconds() + timeout;
+        while (true) {
+            if (mScanned < mBuffer.size()) {
+                std::string_view unscanned = std::string_view(mBuffer).substr(mScanned);
+                std::size_t end = mMatcher->find(unscanned);
+                if (end != details::PatternMatcher::npos) {
+                    mScanned += end;
+                    mConsumed = mScanned;
+                    int index = mMatcher->matched();
+                    std::size_t size = mPatterns[index].size();
+                    std::string_view consumed = std::string_view(mBuffer).substr(0, mConsumed);
+                    return {index, consumed.substr(0, mConsumed - size),
+                        consumed.substr(mConsumed - size)};
+                }
+                mScanned = mBuffer.size();
+            }
+            if (mEof) {
+                mScanned = mConsumed = mBuffer.size();
+                return {-1, mBuffer, {}};
+            }
+            if (!read_more(deadline)) {
+                TimeoutExpired error("Expect::expect timeout reached");
+                error.cmd = mPopen.args;
+                error.timeout = timeout;
+                error.cout = mBuffer;
+                throw error;
+            }
+        }
+    }
+}
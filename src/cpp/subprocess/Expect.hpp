@@ -0,0 +1,124 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ProcessBuilder.hpp"
+
+namespace subprocess {
+    /** @cond PRIVATE */
+    namespace details {
+        class PatternMatcher;
+    }
+    /** @endcond */
+
+    /** Drives an interactive program by waiting for its prompts.
+
+        e.g.
+        @code
+            Expect session({"sqlite3", "-interactive"});
+            session.expect({"sqlite> "});
+            session.send("select 1+1;\n");
+            auto reply = session.expect({"sqlite> ", "Error"}, 5);
+            if (reply.index == 0)
+                use(reply.before);
+        @endcode
+
+        The patterns are literals matched with an Aho-Corasick automaton.
+        Output is scanned once as it arrives, waiting longer for a prompt or
+        trying several prompts costs no rescanning. The automaton is kept
+        while the same patterns are used.
+
+        Output after the match stays buffered for the next expect(). Programs
+        writing to a pipe usually buffer their output, the program must flush
+        its prompts for this to work.
+    */
+    class Expect {
+    public:
+        struct Match {
+            /** Index of the pattern matched, -1 at the end of output. */
+            int                 index = -1;
+            /** Output consumed before the match. At the end of output it is
+                all of the remaining output.
+            */
+            std::string_view    before;
+            /** The text of the matched pattern. */
+            std::string_view    match;
+        };
+
+        /** Starts command with cin & cout piped to the session.
+
+            cerr is left as in options. Piping it leaves it unread, rather
+            use PipeOption::cout to expect on both.
+        */
+        Expect(CommandLine command, RunOptions options={});
+        /** Takes over an already running process.
+
+            @throw std::invalid_argument if cin or cout is not a pipe.
+        */
+        explicit Expect(Popen&& popen);
+        Expect(const Expect&)=delete;
+        Expect& operator=(const Expect&)=delete;
+        /** Closes cin & cout and waits for the process. */
+        ~Expect();
+
+        /** Writes all of data to cin.
+
+            This blocks while the pipe is full, don't send more than the
+            program takes without expecting its output in between.
+
+            @throw OSError if writing fails, e.g. the program has exited.
+                   SIGPIPE is blocked during the write, it fails with EPIPE.
+        */
+        void send(std::string_view data);
+        /** Sends line followed by a newline. */
+        void sendline(std::string_view line);
+        /** Closes cin, the program sees the end of its input. */
+        void send_eof() { mPopen.close_cin(); }
+
+        /** Reads until one of the patterns is seen.
+
+            The output up to and including the match is consumed. When
+            several patterns match, the one ending first wins.
+
+            @param patterns     Literals to look for. Empty waits for the end
+                                of output.
+            @param timeout      Seconds to wait, negative waits forever.
+
+            @return the match, its views are valid until the next expect().
+
+            @throw TimeoutExpired   if nothing matched in time. The output
+                                    read so far stays buffered and is in
+                                    TimeoutExpired::cout.
+            @throw std::invalid_argument if a pattern is empty.
+        */
+        Match expect(const std::vector<std::string>& patterns, double timeout=-1);
+
+        /** Output read but not consumed yet. */
+        std::string_view buffer() const {
+            return std::string_view(mBuffer).substr(mConsumed);
+        }
+        /** The process, e.g. to wait() for it or send it a signal. */
+        Popen& popen() { return mPopen; }
+    private:
+        /** Reads some more output.
+
+            @param deadline monotonic_seconds() to give up at, negative
+                            waits forever.
+            @return false if the deadline was reached.
+        */
+        bool read_more(double deadline);
+
+        Popen                       mPopen;
+        std::string                 mBuffer;
+        // mBuffer[0, mConsumed) is what the last match consumed
+        std::size_t                 mConsumed   = 0;
+        // mBuffer[0, mScanned) has been fed to mMatcher
+        std::size_t                 mScanned    = 0;
+        bool                        mEof        = false;
+        std::vector<std::string>    mPatterns;
+        std::unique_ptr<details::PatternMatcher> mMatcher;
+    };
+}
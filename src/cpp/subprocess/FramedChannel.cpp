@@ -0,0 +1,134 @@
+#include "FramedChannel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "SigPipeGuard.hpp"
+
+namespace {
+    constexpr std::size_t kMinRead = 64*1024;
+}
+
+namespace subprocess {
+    FramedChannel::FramedChannel(Popen& popen) : mPopen(&popen) {
+        if (popen.cin == kBadPipeValue || popen.cout == kBadPipeValue)
+            throw std::invalid_argument("FramedChannel: cin & cout must be pipes");
+        mInput = popen.cout;
+        mOutput = popen.cin;
+    }
+
+    FramedChannel::FramedChannel(PipeHandle input, PipeHandle output)
+    : mInput(input), mOutput(output) {
+    }
+
+    void FramedChannel::send(std::string_view message) {
+        std::uint64_t length = message.size();
+        do {
+            char byte = (char)(length & 0x7f);
+            length >>= 7;
+            if (length)
+                byte |= (char)0x80;
+            mPrefixes.push_back(byte);
+        } while (length);
+        mPrefixEnds.push_back((std::uint32_t)mPrefixes.size());
+        mPending.push_back(message);
+        mPendingSize += message.size();
+        if (mPendingSize + mPrefixes.size() >= flush_size)
+            flush();
+    }
+
+    void FramedChannel::flush() {
+        if (mPending.empty())
+            return;
+        if (mOutput == kBadPipeValue)
+            throw std::invalid_argument("FramedChannel: nothing to write to");
+        std::vector<PipeBuffer> buffers;
+        buffers.reserve(2*mPending.size());
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < mPending.size(); ++i) {
+            buffers.emplace_back(&mPrefixes[begin], mPrefixEnds[i] - begin);
+            if (!mPending[i].empty())
+                buffers.emplace_back(mPending[i]);
+            begin = mPrefixEnds[i];
+        }
+        std::size_t total = mPendingSize + mPrefixes.size();
+        // a peer that exited fails the write instead of killing us
+        details::SigPipeGuard guard;
+        if (pipe_writev_all(mOutput, buffers.data(), buffers.size()) < total) {
+            details::throw_os_error("FramedChannel::flush", errno);
+            throw OSError("FramedChannel::flush failed");
+        }
+        mPrefixes.clear();
+        mPrefixEnds.clear();
+        mPending.clear();
+        mPendingSize = 0;
+    }
+
+    void FramedChannel::close() {
+        flush();
+        if (mPopen)
+            mPopen->close_cin();
+        else if (mOutput != kBadPipeValue)
+            pipe_close(mOutput);
+        mOutput = kBadPipeValue;
+    }
+
+    bool FramedChannel::receive(std::string_view& message) {
+        if (mInput == kBadPipeValue)
+            throw std::invalid_argument("FramedChannel: nothing to read from");
+        while (true) {
+            std::uint64_t length = 0;
+            std::size_t pos = mStart;
+            bool complete = false;
+            for (int shift = 0; pos < mEnd; shift += 7) {
+                if (shift > 63)
+                    throw std::runtime_error("FramedChannel: bad message length");
+                unsigned char byte = (unsigned char)mBuffer[pos++];
+                length |= (std::uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    complete = true;
+                    break;
+                }
+            }
+            if (complete && length > max_message_size)
+                throw std::runtime_error("FramedChannel: message larger than max_message_size");
+            if (complete && mEnd - pos >= length) {
+                message = std::string_view(&mBuffer[pos], (std::size_t)length);
+                mStart = pos + (std::size_t)length;
+                return true;
+            }
+
+            // make room for the rest of the message, or at least a prefix
+            std::size_t pending = mEnd - mStart;
+            std::size_t required = complete? (pos - mStart) + (std::size_t)length : pending + 16;
+            if (pending == 0) {
+                mStart = mEnd = 0;
+            } else if (mStart + std::max(required, kMinRead) > mBuffer.size()) {
+                std::memmove(&mBuffer[0], &mBuffer[mStart], pending);
+                mStart = 0;
+                mEnd = pending;
+            }
+            if (mBuffer.size() < std::max(required, kMinRead))
+                mBuffer.resize(std::max(required, kMinRead));
+
+            ssize_t transfered = pipe_read(mInput, &mBuffer[mEnd], mBuffer.size() - mEnd);
+            if (transfered < 0) {
+#ifndef _WIN32
+                if (errno == EINTR)
+                    continue;
+                details::throw_os_error("read", errno);
+#endif
+                // windows reports a closed pipe as an error
+                transfered = 0;
+            }
+            if (transfered == 0) {
+                if (mStart == mEnd)
+                    return false;
+                throw std::runtime_error("FramedChannel: input ended within a message");
+            }
+            mEnd += transfered;
+        }
+    }
+}
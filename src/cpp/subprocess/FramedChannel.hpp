@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "ProcessBuilder.hpp"
+
+namespace subprocess {
+    /** Length prefixed messages over a pair of pipes, e.g. the stdio of a
+        worker process.
+
+        Every message is preceded by its length as an unsigned LEB128
+        varint. Sent messages are queued and written together with one
+        writev() per flush(), received messages are parsed in place from a
+        reusable buffer that is filled with as much as each read returns.
+
+        Many requests can be in flight, send a batch, flush() and receive
+        the replies:
+        @code
+            Popen worker = RunBuilder({"worker"}).cin(PipeOption::pipe)
+                .cout(PipeOption::pipe).popen();
+            FramedChannel channel(worker);
+            for (auto& request : requests)
+                channel.send(request);
+            channel.flush();
+            std::string_view reply;
+            while (channel.receive(reply))
+                handle(reply);
+        @endcode
+
+        The sending side (send, flush, close) and receiving side (receive)
+        may each be used from a different thread. If the peer answers while
+        it reads, keep the number of unanswered bytes below what the pipes
+        buffer, or send from another thread, otherwise both sides block.
+    */
+    class FramedChannel {
+    public:
+        /** Writes to popen.cin & reads from popen.cout, which must be pipes.
+            popen must outlive the channel.
+
+            @throw std::invalid_argument if cin or cout is not a pipe.
+        */
+        explicit FramedChannel(Popen& popen);
+        /** Reads messages from input and writes them to output. Either may
+            be kBadPipeValue for one way use. The handles stay owned by the
+            caller unless close() is called.
+        */
+        FramedChannel(PipeHandle input, PipeHandle output);
+        FramedChannel(const FramedChannel&)=delete;
+        FramedChannel& operator=(const FramedChannel&)=delete;
+
+        /** Queues message. It's not copied, it must stay valid until the
+            next flush(). Flushes once the queue holds flush_size bytes.
+
+            @throw OSError if writing fails.
+        */
+        void send(std::string_view message);
+        /** Writes all queued messages.
+
+            @throw OSError if writing fails, e.g. the peer has exited.
+                   SIGPIPE is blocked during the write, it fails with EPIPE.
+        */
+        void flush();
+        /** Flushes and closes the writing side, Popen::close_cin() or
+            pipe_close(output).
+        */
+        void close();
+
+        /** Waits for the next message.
+
+            @param message  set to the message, valid until the next
+                            receive().
+
+            @return false at the end of input.
+
+            @throw std::runtime_error if the input is not well framed,
+                   ends within a message or a message is larger than
+                   max_message_size.
+            @throw OSError if reading fails.
+        */
+        bool receive(std::string_view& message);
+
+        /** Queued bytes that trigger a flush() from send(). */
+        std::size_t flush_size = 256*1024;
+        /** Largest message receive() accepts, a corrupt length prefix
+            would otherwise allocate that much.
+        */
+        std::size_t max_message_size = std::size_t(1) << 30;
+    private:
+        Popen*              mPopen  = nullptr;
+        PipeHandle          mInput  = kBadPipeValue;
+        PipeHandle          mOutput = kBadPipeValue;
+
+        // mPending[i] goes after its prefix, the bytes of mPrefixes from
+        // mPrefixEnds[i-1] (0 for the first) up to mPrefixEnds[i]
+        std::vector<char>               mPrefixes;
+        std::vector<std::uint32_t>      mPrefixEnds;
+        std::vector<std::string_view>   mPending;
+        std::size_t                     mPendingSize = 0;
+
+        // received bytes not parsed yet are mBuffer[mStart, mEnd)
+        std::vector<char>   mBuffer;
+        std::size_t         mStart  = 0;
+        std::size_t         mEnd    = 0;
+    };
+}
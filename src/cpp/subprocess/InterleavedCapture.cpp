@@ -0,0 +1,59 @@
+#include "InterleavedCapture.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "ProcessBuilder.hpp"
+
+namespace {
+    using subprocess::InterleavedCapture;
+
+    class StreamSink : public subprocess::OutputSink {
+    public:
+        StreamSink(InterleavedCapture& capture, InterleavedCapture::Stream stream)
+        : mCapture(capture), mStream(stream) {}
+        void write(std::string_view chunk) override {
+            mCapture.append(mStream, chunk);
+        }
+    private:
+        InterleavedCapture&         mCapture;
+        InterleavedCapture::Stream  mStream;
+    };
+}
+
+namespace subprocess {
+    std::shared_ptr<OutputSink> InterleavedCapture::cout() {
+        return std::make_shared<StreamSink>(*this, Stream::cout);
+    }
+    std::shared_ptr<OutputSink> InterleavedCapture::cerr() {
+        return std::make_shared<StreamSink>(*this, Stream::cerr);
+    }
+
+    void InterleavedCapture::append(Stream stream, std::string_view chunk) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        // under the lock, so timestamps follow the chunk order
+        double now = monotonic_seconds();
+        // Chunk::size is 32 bits to keep the index small
+        while (!chunk.empty()) {
+            std::size_t size = std::min<std::size_t>(chunk.size(), UINT32_MAX);
+            mChunks.push_back({mData.size(), (std::uint32_t)size, stream, now});
+            mData.append(chunk.data(), size);
+            chunk.remove_prefix(size);
+        }
+    }
+
+    void InterleavedCapture::for_each(Stream stream, const ChunkCallback& callback) const {
+        for (const Chunk& chunk : mChunks) {
+            if (chunk.stream == stream)
+                callback(view(chunk));
+        }
+    }
+
+    std::string InterleavedCapture::str(Stream stream) const {
+        std::string result;
+        for_each(stream, [&](std::string_view chunk) {
+            result.append(chunk);
+        });
+        return result;
+    }
+}
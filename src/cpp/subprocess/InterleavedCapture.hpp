@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "OutputSink.hpp"
+
+namespace subprocess {
+    /** Captures cout and cerr together in the order they arrived.
+
+        All output goes into one buffer, in arrival order, and a compact
+        index records the stream, position and time of every chunk read. The
+        log can be replayed interleaved or split per stream without copying
+        anything.
+
+        e.g.
+        @code
+            InterleavedCapture capture;
+            RunBuilder(cmd).cout(capture.cout()).cerr(capture.cerr()).run();
+            for (auto& chunk : capture.chunks())
+                log(chunk.stream, chunk.time, capture.view(chunk));
+        @endcode
+
+        On posix run() reads both pipes from a single poll() loop, so the
+        order is exactly the order in which the reads completed. Data the
+        child wrote to both streams before the parent got to read either is
+        ordered cout first. On windows each stream has its own thread and
+        the order is as close as the scheduler allows.
+
+        The capture must outlive the run, the sinks refer to it.
+        CompletedProcess::cout/cerr stay empty.
+    */
+    class InterleavedCapture {
+    public:
+        enum class Stream : std::uint8_t {
+            cout,
+            cerr
+        };
+        struct Chunk {
+            /** Position in data() */
+            std::size_t     offset;
+            std::uint32_t   size;
+            Stream          stream;
+            /** monotonic_seconds() when the chunk was read. */
+            double          time;
+        };
+
+        InterleavedCapture(){}
+        InterleavedCapture(const InterleavedCapture&)=delete;
+        InterleavedCapture& operator=(const InterleavedCapture&)=delete;
+
+        /** @return sink to use as cout */
+        std::shared_ptr<OutputSink> cout();
+        /** @return sink to use as cerr */
+        std::shared_ptr<OutputSink> cerr();
+
+        /** All output of both streams in arrival order. Valid until more
+            output is captured.
+        */
+        std::string_view data() const { return mData; }
+        /** Index of the chunks in arrival order. */
+        const std::vector<Chunk>& chunks() const { return mChunks; }
+        /** @return the bytes of chunk. */
+        std::string_view view(const Chunk& chunk) const {
+            return std::string_view(mData).substr(chunk.offset, chunk.size);
+        }
+        /** Calls callback with every chunk of stream in order. */
+        void for_each(Stream stream, const ChunkCallback& callback) const;
+        /** @return a copy of everything stream wrote. */
+        std::string str(Stream stream) const;
+
+        /** Appends a chunk, called by the sinks. Thread safe. */
+        void append(Stream stream, std::string_view chunk);
+    private:
+        std::mutex          mMutex;
+        std::string         mData;
+        std::vector<Chunk>  mChunks;
+    };
+}
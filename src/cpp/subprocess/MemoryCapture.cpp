@@ -0,0 +1,20 @@
+#include "MemoryCapture.hpp"
+
+#include "TempFile.hpp"
+
+namespace subprocess {
+    MemoryCapture::MemoryCapture() {
+        mFile = std::make_unique<details::TempFile>(true);
+    }
+    MemoryCapture::~MemoryCapture() {
+    }
+    PipeHandle MemoryCapture::handle() const {
+        return mFile->handle();
+    }
+    std::uint64_t MemoryCapture::size() const {
+        return mFile->size();
+    }
+    std::string_view MemoryCapture::view() {
+        return mFile->map();
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "basic_types.hpp"
+
+namespace subprocess {
+    namespace details {
+        class TempFile;
+    }
+    /** Lets the child write its output straight into an in memory file.
+
+        On linux this is a memfd, elsewhere an anonymous temporary file. The
+        child gets the file as its cout/cerr so there is no pipe, no thread
+        and no copy in the parent. Once the process is done view() maps the
+        file read only, ready to be parsed in place.
+
+        e.g.
+        @code
+            auto capture = std::make_shared<MemoryCapture>();
+            run(command, RunBuilder().cout(capture));
+            std::string_view output = capture->view();
+        @endcode
+
+        Using the same capture for several processes appends to it.
+    */
+    class MemoryCapture {
+    public:
+        MemoryCapture();
+        ~MemoryCapture();
+        MemoryCapture(const MemoryCapture&)=delete;
+        MemoryCapture& operator=(const MemoryCapture&)=delete;
+
+        /** The file handle given to the child. Still owned by this object. */
+        PipeHandle handle() const;
+        /** @return bytes written so far. */
+        std::uint64_t size() const;
+        /** Read only view of everything written. Only call after the child
+            finished writing. Valid until destruction or until more is
+            written to it.
+        */
+        std::string_view view();
+    private:
+        std::unique_ptr<details::TempFile> mFile;
+    };
+}
@@ -0,0 +1,209 @@
+#include "MergedOutput.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+
+#include "simd.hpp"
+
+using subprocess::details::find_byte;
+
+namespace subprocess {
+    /*  Shared between MergedOutput, its sinks & the flusher so sinks may
+        outlive the MergedOutput without dangling.
+    */
+    struct MergedOutput::State {
+        struct Batch {
+            Batch*      next = nullptr;
+            std::string data;
+        };
+
+        explicit State(std::shared_ptr<OutputSink> destination)
+        : destination(std::move(destination)) {}
+        ~State() {
+            Batch* batch = head.exchange(nullptr);
+            while (batch) {
+                Batch* next = batch->next;
+                delete batch;
+                batch = next;
+            }
+        }
+
+        // multiple producers, the flusher is the only consumer
+        void push(Batch* batch) {
+            Batch* old = head.load(std::memory_order_relaxed);
+            do {
+                batch->next = old;
+            } while (!head.compare_exchange_weak(old, batch,
+                std::memory_order_release, std::memory_order_relaxed));
+            pushed.fetch_add(1, std::memory_order_relaxed);
+            // unlocked so a notify can be missed, the flusher polls anyway
+            if (old == nullptr)
+                wake.notify_one();
+        }
+
+        void run() {
+            std::string output;
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+                    return stop || head.load(std::memory_order_relaxed) != nullptr;
+                });
+                bool stopping = stop;
+                bool failed = error != nullptr;
+                Batch* batch = head.exchange(nullptr, std::memory_order_acquire);
+                lock.unlock();
+
+                // the stack is newest first, reverse it to keep each sink's order
+                Batch* ordered = nullptr;
+                std::size_t count = 0;
+                while (batch) {
+                    Batch* next = batch->next;
+                    batch->next = ordered;
+                    ordered = batch;
+                    batch = next;
+                    ++count;
+                }
+                output.clear();
+                while (ordered) {
+                    Batch* next = ordered->next;
+                    output += ordered->data;
+                    delete ordered;
+                    ordered = next;
+                }
+                std::exception_ptr failure;
+                if (!output.empty() && !failed) {
+                    try {
+                        destination->write(output);
+                    } catch (...) {
+                        failure = std::current_exception();
+                    }
+                }
+
+                lock.lock();
+                if (failure)
+                    error = failure;
+                written += count;
+                if (count > 0)
+                    done.notify_all();
+                if (stopping && head.load() == nullptr)
+                    return;
+            }
+        }
+
+        std::shared_ptr<OutputSink> destination;
+        std::atomic<Batch*>         head{nullptr};
+        std::atomic<std::size_t>    pushed{0};
+        // below are guarded by mutex
+        std::mutex                  mutex;
+        std::condition_variable     wake;
+        std::condition_variable     done;
+        std::size_t                 written = 0;
+        bool                        stop    = false;
+        std::exception_ptr          error;
+        std::thread                 flusher;
+    };
+
+    namespace {
+        class TaggedLineSink : public OutputSink {
+        public:
+            TaggedLineSink(std::shared_ptr<MergedOutput::State> state, std::string prefix)
+            : mState(std::move(state)), mPrefix(std::move(prefix)) {}
+
+            void write(std::string_view chunk) override {
+                const char* pos = chunk.data();
+                const char* end = pos + chunk.size();
+                auto batch = std::make_unique<MergedOutput::State::Batch>();
+                std::string& data = batch->data;
+                data.reserve(chunk.size() + chunk.size()/8 + mPrefix.size() + mPartial.size());
+                while (pos < end) {
+                    const char* newline = find_byte(pos, end, '\n');
+                    if (newline == end) {
+                        mPartial.append(pos, end - pos);
+                        break;
+                    }
+                    data += mPrefix;
+                    if (!mPartial.empty()) {
+                        data += mPartial;
+                        mPartial.clear();
+                    }
+                    data.append(pos, newline + 1 - pos);
+                    pos = newline + 1;
+                }
+                if (!data.empty())
+                    mState->push(batch.release());
+            }
+            void finish() override {
+                if (mPartial.empty())
+                    return;
+                auto batch = std::make_unique<MergedOutput::State::Batch>();
+                batch->data = mPrefix + mPartial + "\n";
+                mPartial.clear();
+                mState->push(batch.release());
+            }
+        private:
+            std::shared_ptr<MergedOutput::State> mState;
+            std::string mPrefix;
+            std::string mPartial;
+        };
+
+        class OstreamSink : public OutputSink {
+        public:
+            OstreamSink(std::ostream& stream) : mStream(stream) {}
+            void write(std::string_view chunk) override {
+                mStream.write(chunk.data(), chunk.size());
+            }
+            void finish() override { mStream.flush(); }
+        private:
+            std::ostream& mStream;
+        };
+    }
+
+    MergedOutput::MergedOutput(std::shared_ptr<OutputSink> destination) {
+        if (!destination)
+            throw std::invalid_argument("MergedOutput: destination is null");
+        mState = std::make_shared<State>(std::move(destination));
+        State* state = mState.get();
+        mState->flusher = std::thread([state]() { state->run(); });
+    }
+
+    MergedOutput::MergedOutput(std::ostream& destination)
+    : MergedOutput(std::make_shared<OstreamSink>(destination)) {
+    }
+
+    MergedOutput::~MergedOutput() {
+        {
+            std::unique_lock<std::mutex> lock(mState->mutex);
+            mState->stop = true;
+        }
+        mState->wake.notify_one();
+        mState->flusher.join();
+        if (!mState->error) {
+            try {
+                mState->destination->finish();
+            } catch (...) {
+            }
+        }
+    }
+
+    std::shared_ptr<OutputSink> MergedOutput::sink(std::string prefix) {
+        return std::make_shared<TaggedLineSink>(mState, std::move(prefix));
+    }
+
+    void MergedOutput::flush() {
+        std::size_t target = mState->pushed.load();
+        std::unique_lock<std::mutex> lock(mState->mutex);
+        mState->wake.notify_one();
+        mState->done.wait(lock, [&]() { return mState->written >= target; });
+        if (mState->error) {
+            std::exception_ptr error = mState->error;
+            mState->error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+#include "OutputSink.hpp"
+
+namespace subprocess {
+    /** Merges the output of many children into one destination, each line
+        prefixed with a per stream tag, like `docker compose logs`.
+
+        Every stream gets its own sink from sink(). A sink turns the chunks
+        of its stream into whole prefixed lines in a buffer only it touches,
+        then hands the batch over to a lock free queue. A single flusher
+        thread drains the queue and writes everything it collected to the
+        destination in one go. Lines are never torn, and no lock is taken
+        per line or per child.
+
+        e.g.
+        @code
+            MergedOutput merged(std::cout);
+            for (auto& name : services)
+                popens.push_back(RunBuilder({"serve", name})
+                    .cout(merged.sink(name + " | ")).popen());
+            // subprocess::run(popen) for each in its own thread
+        @endcode
+
+        A final line without a newline gets one added.
+    */
+    class MergedOutput {
+    public:
+        /** @param destination  receives the merged output, only ever from
+                                the flusher thread.
+        */
+        explicit MergedOutput(std::shared_ptr<OutputSink> destination);
+        /** Writes to a std::ostream which must outlive this object. */
+        explicit MergedOutput(std::ostream& destination);
+        /** Flushes what was handed over so far and stops the flusher. */
+        ~MergedOutput();
+        MergedOutput(const MergedOutput&)=delete;
+        MergedOutput& operator=(const MergedOutput&)=delete;
+
+        /** Creates the sink for one stream. Use a separate sink for cout and
+            cerr of the same child.
+
+            @param prefix   written in front of every line.
+        */
+        std::shared_ptr<OutputSink> sink(std::string prefix);
+        /** Waits until everything the sinks handed over is written.
+
+            @throw the error the destination threw, if any.
+        */
+        void flush();
+
+        /** @cond PRIVATE */
+        struct State;
+        /** @endcond */
+    private:
+        std::shared_ptr<State> mState;
+    };
+}
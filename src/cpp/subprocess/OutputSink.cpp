@@ -0,0 +1,191 @@
+#include "OutputSink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include "pipe.hpp"
+#include "simd.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+using subprocess::details::find_byte;
+
+namespace subprocess {
+    void LineSink::write(std::string_view chunk) {
+        const char* pos = chunk.data();
+        const char* end = pos + chunk.size();
+        if (!mPartial.empty()) {
+            const char* newline = find_byte(pos, end, '\n');
+            mPartial.append(pos, newline - pos);
+            if (newline == end)
+                return;
+            mCallback(mPartial);
+            mPartial.clear();
+            pos = newline + 1;
+        }
+        while (pos < end) {
+            const char* newline = find_byte(pos, end, '\n');
+            if (newline == end) {
+                mPartial.assign(pos, end - pos);
+                return;
+            }
+            mCallback(std::string_view(pos, newline - pos));
+            pos = newline + 1;
+        }
+    }
+
+    void LineSink::finish() {
+        if (mPartial.empty())
+            return;
+        mCallback(mPartial);
+        mPartial.clear();
+    }
+
+    TailCapture::TailCapture(std::size_t tail, std::size_t head) {
+        mHeadCapacity = head;
+        mHead.reserve(head);
+        mRing.resize(tail);
+    }
+
+    void TailCapture::write(std::string_view chunk) {
+        mTotal += chunk.size();
+        if (mHead.size() < mHeadCapacity) {
+            std::size_t take = std::min(mHeadCapacity - mHead.size(), chunk.size());
+            mHead.append(chunk.data(), take);
+            chunk.remove_prefix(take);
+        }
+        const std::size_t capacity = mRing.size();
+        if (capacity == 0 || chunk.empty())
+            return;
+        if (chunk.size() >= capacity) {
+            // only the end of the chunk survives
+            chunk.remove_prefix(chunk.size() - capacity);
+            std::copy(chunk.begin(), chunk.end(), mRing.begin());
+            mRingStart  = 0;
+            mRingSize   = capacity;
+            return;
+        }
+        std::size_t end = (mRingStart + mRingSize) % capacity;
+        std::size_t first = std::min(chunk.size(), capacity - end);
+        std::copy(chunk.begin(), chunk.begin() + first, mRing.begin() + end);
+        std::copy(chunk.begin() + first, chunk.end(), mRing.begin());
+        mRingSize += chunk.size();
+        if (mRingSize > capacity) {
+            // overwrote the oldest bytes
+            mRingStart = (mRingStart + mRingSize - capacity) % capacity;
+            mRingSize = capacity;
+        }
+    }
+
+    std::string TailCapture::str() const {
+        std::string result;
+        result.reserve(mHead.size() + mRingSize);
+        result += mHead;
+        std::size_t first = std::min(mRingSize, mRing.size() - mRingStart);
+        result.append(mRing, mRingStart, first);
+        result.append(mRing, 0, mRingSize - first);
+        return result;
+    }
+
+    void TailCapture::collect(std::string& output, std::size_t& dropped) {
+        output  = str();
+        dropped = this->dropped();
+    }
+
+    FanOutSink& FanOutSink::add(std::shared_ptr<OutputSink> sink) {
+        mSinks.push_back(std::move(sink));
+        return *this;
+    }
+
+    FanOutSink& FanOutSink::add(ChunkCallback callback) {
+        return add(std::make_shared<CallbackSink>(std::move(callback)));
+    }
+
+    FanOutSink& FanOutSink::add(PipeHandle handle, bool autoclose) {
+        mFds.push_back({handle, autoclose});
+        return *this;
+    }
+
+    void FanOutSink::write(std::string_view chunk) {
+        if (mCapture)
+            mCaptured.append(chunk);
+        for (auto& sink : mSinks)
+            sink->write(chunk);
+        for (std::size_t i = mFds.size(); i-- > 0;) {
+            FdDestination& fd = mFds[i];
+            std::size_t skip = std::min(fd.teed, chunk.size());
+            fd.teed -= skip;
+            std::size_t size = chunk.size() - skip;
+            if (size > 0 && pipe_write_all(fd.handle, chunk.data() + skip, size) < size) {
+                if (fd.autoclose)
+                    pipe_close(fd.handle);
+                mFds.erase(mFds.begin() + i);
+            }
+        }
+    }
+
+    void FanOutSink::finish() {
+        for (auto& sink : mSinks)
+            sink->finish();
+        for (FdDestination& fd : mFds) {
+            if (fd.autoclose)
+                pipe_close(fd.handle);
+        }
+        mFds.clear();
+    }
+
+    void FanOutSink::collect(std::string& output, std::size_t& dropped) {
+        if (mCapture) {
+            output = std::move(mCaptured);
+            mCaptured.clear();
+            dropped = 0;
+            return;
+        }
+        for (auto& sink : mSinks) {
+            std::string retained;
+            std::size_t sink_dropped = 0;
+            sink->collect(retained, sink_dropped);
+            if (output.empty() && (!retained.empty() || sink_dropped > 0)) {
+                output = std::move(retained);
+                dropped = sink_dropped;
+            }
+        }
+    }
+
+    std::size_t FanOutSink::copy_from(PipeHandle source, std::size_t max) {
+#ifdef __linux__
+        /*  tee() always starts at the head of source, so the first copy
+            decides the chunk and the others copy at most that much. What a
+            destination misses is written from the chunk read afterwards.
+        */
+        std::size_t copied = 0;
+        for (FdDestination& fd : mFds) {
+            fd.teed = 0;
+            if (!fd.tee)
+                continue;
+            ssize_t transfered;
+            do {
+                transfered = tee(source, fd.handle, copied? copied : max, 0);
+            } while (transfered < 0 && errno == EINTR);
+            if (transfered < 0) {
+                // not pipes, or broken, write() takes care of it
+                fd.tee = false;
+                continue;
+            }
+            if (transfered == 0) {
+                if (copied == 0)
+                    return 0; // end of source
+                continue;
+            }
+            if (copied == 0)
+                copied = transfered;
+            fd.teed = transfered;
+        }
+        return copied;
+#else
+        return 0;
+#endif
+    }
+}
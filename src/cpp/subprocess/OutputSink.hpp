@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "basic_types.hpp"
+
+namespace subprocess {
+    /** Called with each chunk of output as it is read from the child. The
+        memory is not yours, it is only valid for the duration of the call.
+    */
+    typedef std::function<void(std::string_view chunk)> ChunkCallback;
+    /** Called with each line of output, without the terminating '\n'. The
+        memory is only valid for the duration of the call.
+    */
+    typedef std::function<void(std::string_view line)> LineCallback;
+
+    /** Destination for output read from a child process.
+
+        Use it as cout/cerr and run() will deliver the output to it chunk by
+        chunk from its read loop instead of capturing everything in
+        CompletedProcess. Memory use is constant no matter how much the child
+        outputs.
+
+        When using Popen directly, the sink is only serviced once you call
+        subprocess::run(popen).
+    */
+    class OutputSink {
+    public:
+        virtual ~OutputSink(){}
+        /** Receives the next chunk of output. The memory is owned by the
+            caller and only valid for the duration of the call.
+        */
+        virtual void write(std::string_view chunk) = 0;
+        /** Called once after the last chunk when the stream is finished. */
+        virtual void finish() {}
+        /** Called by run() after finish(). Sinks that retain output move it
+            into output, which becomes CompletedProcess::cout/cerr.
+
+            @param dropped  set to the number of bytes that were not retained.
+        */
+        virtual void collect(std::string& /*output*/, std::size_t& /*dropped*/) {}
+        /** Called by run() before reading the next chunk from a pipe. A sink
+            that copies straight from the pipe, e.g. with tee(), copies up to
+            max bytes and returns how many. run() then reads exactly those
+            bytes and passes them to write() as usual. 0 lets run() read
+            as usual.
+
+            Not called while a stop pattern is set, the match may end the
+            output within a chunk.
+        */
+        virtual std::size_t copy_from(PipeHandle /*source*/, std::size_t /*max*/) { return 0; }
+    };
+
+    /** OutputSink forwarding to a ChunkCallback. This is what a ChunkCallback
+        passed as cout/cerr turns into.
+    */
+    class CallbackSink : public OutputSink {
+    public:
+        CallbackSink(ChunkCallback callback) : mCallback(std::move(callback)) {}
+        void write(std::string_view chunk) override { mCallback(chunk); }
+    private:
+        ChunkCallback mCallback;
+    };
+
+    /** Appends output to a string owned by the caller, e.g. to reuse one
+        buffer across many runs of a command instead of allocating a new
+        string each time. Clear it yourself between runs, its capacity is
+        kept.
+
+        Nothing is copied into CompletedProcess, CalledProcessError or
+        TimeoutExpired, their cout/cerr stay empty. The buffer must outlive
+        the process.
+    */
+    class AppendCapture : public OutputSink {
+    public:
+        AppendCapture(std::string& buffer) : mBuffer(buffer) {}
+        void write(std::string_view chunk) override { mBuffer.append(chunk); }
+    private:
+        std::string& mBuffer;
+    };
+
+    /** Splits output into lines and calls a LineCallback for each.
+
+        Newlines are located with a vectorized scan (AVX2/SSE2 when the cpu
+        has them) and lines are passed as views into the read buffer. Only a
+        line crossing a chunk boundary is copied, to stitch it together.
+        A final line without a trailing newline is delivered by finish().
+
+        e.g. `RunBuilder(cmd).cout(std::make_shared<LineSink>(callback))`
+    */
+    class LineSink : public OutputSink {
+    public:
+        LineSink(LineCallback callback) : mCallback(std::move(callback)) {}
+        void write(std::string_view chunk) override;
+        void finish() override;
+    private:
+        LineCallback    mCallback;
+        std::string     mPartial;
+    };
+
+    /** Delivers each chunk to several destinations from a single read, e.g.
+        capture cout, log it to a file and hash it in one pass:
+        @code
+            auto fan = std::make_shared<FanOutSink>();
+            fan->capture().add(log_fd).add([&](std::string_view chunk) {
+                hasher.update(chunk);
+            });
+            auto completed = RunBuilder(cmd).cout(fan).run();
+        @endcode
+
+        On linux fd destinations that are pipes get the data with tee(),
+        duplicated inside the kernel before run() reads it. A pipe that is
+        only partly tee()d and other fds, e.g. files, are written the
+        chunk. A destination that fails, e.g. a reader that exited, is
+        dropped. Writing to a pipe whose reader is gone raises SIGPIPE as
+        any write, ignore it if that can happen.
+    */
+    class FanOutSink : public OutputSink {
+    public:
+        /** Keeps the output for CompletedProcess::cout/cerr. */
+        FanOutSink& capture() { mCapture = true; return *this; }
+        FanOutSink& add(std::shared_ptr<OutputSink> sink);
+        FanOutSink& add(ChunkCallback callback);
+        /** Writes to handle, which stays the caller's unless autoclose,
+            then it's closed by finish().
+        */
+        FanOutSink& add(PipeHandle handle, bool autoclose=false);
+
+        void write(std::string_view chunk) override;
+        void finish() override;
+        /** The captured output, else what the first destination retaining
+            output collects.
+        */
+        void collect(std::string& output, std::size_t& dropped) override;
+        std::size_t copy_from(PipeHandle source, std::size_t max) override;
+    private:
+        struct FdDestination {
+            PipeHandle  handle;
+            bool        autoclose;
+            bool        tee         = true;
+            // bytes of the chunk being read that tee() already sent
+            std::size_t teed        = 0;
+        };
+        bool                                        mCapture = false;
+        std::string                                 mCaptured;
+        std::vector<std::shared_ptr<OutputSink>>    mSinks;
+        std::vector<FdDestination>                  mFds;
+    };
+
+    /** Keeps only the last tail bytes of output, and optionally the first
+        head bytes, in a fixed size ring buffer. Use it for chatty output of
+        which only the end matters, e.g. cerr of a failing tool.
+
+        run() fills CompletedProcess::cout/cerr with the retained bytes (head
+        followed by tail) and cout_dropped/cerr_dropped with how many bytes
+        were discarded in between. CalledProcessError and TimeoutExpired
+        carry the same.
+    */
+    class TailCapture : public OutputSink {
+    public:
+        TailCapture(std::size_t tail, std::size_t head=0);
+        void write(std::string_view chunk) override;
+        void collect(std::string& output, std::size_t& dropped) override;
+
+        /** @return the retained output, head followed by tail. */
+        std::string str() const;
+        /** @return number of bytes written but not retained. */
+        std::size_t dropped() const { return mTotal - mHead.size() - mRingSize; }
+        /** @return number of bytes written in total. */
+        std::size_t total() const { return mTotal; }
+    private:
+        std::size_t         mHeadCapacity;
+        std::string         mHead;
+        std::string         mRing;
+        std::size_t         mRingStart  = 0;
+        std::size_t         mRingSize   = 0;
+        std::size_t         mTotal      = 0;
+    };
+}
@@ -0,0 +1,100 @@
+#include "PatternMatcher.hpp"
+
+#include <stdexcept>
+
+#include "simd.hpp"
+
+namespace subprocess {
+    namespace details {
+        PatternMatcher::PatternMatcher(const std::vector<std::string>& patterns) {
+            if (patterns.empty())
+                return;
+            constexpr std::uint32_t kNone = UINT32_MAX;
+            // trie first, kNone where there is no edge yet
+            mNext.assign(256, kNone);
+            mOutput.assign(1, -1);
+            for (std::size_t index = 0; index < patterns.size(); ++index) {
+                const std::string& pattern = patterns[index];
+                if (pattern.empty())
+                    throw std::invalid_argument("PatternMatcher: empty pattern");
+                std::uint32_t state = 0;
+                for (unsigned char byte : pattern) {
+                    std::uint32_t& next = mNext[state*256 + byte];
+                    if (next == kNone) {
+                        next = (std::uint32_t)mOutput.size();
+                        mOutput.push_back(-1);
+                        mNext.resize(mNext.size() + 256, kNone);
+                    }
+                    state = mNext[state*256 + byte];
+                }
+                // duplicates keep the first index
+                if (mOutput[state] < 0)
+                    mOutput[state] = (std::int32_t)index;
+            }
+
+            /*  Breadth first, filling the missing edges from the failure
+                state turns the trie into a DFA.
+            */
+            std::vector<std::uint32_t> fail(mOutput.size(), 0);
+            std::vector<std::uint32_t> queue;
+            queue.reserve(mOutput.size());
+            for (unsigned byte = 0; byte < 256; ++byte) {
+                std::uint32_t& next = mNext[byte];
+                if (next == kNone) {
+                    next = 0;
+                } else {
+                    fail[next] = 0;
+                    queue.push_back(next);
+                }
+            }
+            for (std::size_t i = 0; i < queue.size(); ++i) {
+                std::uint32_t state = queue[i];
+                // a pattern that is a suffix of this state also ends here
+                if (mOutput[state] < 0)
+                    mOutput[state] = mOutput[fail[state]];
+                for (unsigned byte = 0; byte < 256; ++byte) {
+                    std::uint32_t& next = mNext[state*256 + byte];
+                    std::uint32_t fallback = mNext[fail[state]*256 + byte];
+                    if (next == kNone) {
+                        next = fallback;
+                    } else {
+                        fail[next] = fallback;
+                        queue.push_back(next);
+                    }
+                }
+            }
+
+            int first = (unsigned char)patterns[0][0];
+            for (const std::string& pattern : patterns) {
+                if ((unsigned char)pattern[0] != first)
+                    first = -1;
+            }
+            mSkipByte = first;
+        }
+
+        std::size_t PatternMatcher::find(std::string_view data) {
+            if (empty())
+                return npos;
+            const char* begin = data.data();
+            const char* end = begin + data.size();
+            const std::uint32_t* next = mNext.data();
+            std::uint32_t state = mState;
+            for (const char* pos = begin; pos < end; ++pos) {
+                if (state == 0 && mSkipByte >= 0) {
+                    // anything else leaves the start state where it is
+                    pos = find_byte(pos, end, (char)mSkipByte);
+                    if (pos == end)
+                        break;
+                }
+                state = next[state*256 + (unsigned char)*pos];
+                if (mOutput[state] >= 0) {
+                    mState = state;
+                    mMatched = mOutput[state];
+                    return pos + 1 - begin;
+                }
+            }
+            mState = state;
+            return npos;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+/** @cond PRIVATE */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace subprocess {
+    namespace details {
+        /** Finds any of several literals in a stream of bytes.
+
+            An Aho-Corasick automaton compiled into a dense table, one lookup
+            per input byte no matter how many patterns there are. The state
+            carries over between calls so matches spanning chunk boundaries
+            are found. When every pattern starts with the same byte the start
+            state skips ahead with find_byte().
+        */
+        class PatternMatcher {
+        public:
+            static constexpr std::size_t npos = std::string_view::npos;
+
+            PatternMatcher(){}
+            /** @throw std::invalid_argument if a pattern is empty. */
+            explicit PatternMatcher(const std::vector<std::string>& patterns);
+
+            bool empty() const { return mOutput.empty(); }
+            /** Scans data, continuing where the previous call left off.
+
+                @return offset in data just past the end of the first match,
+                        or npos. Call again with the rest of data for the
+                        next match.
+            */
+            std::size_t find(std::string_view data);
+            /** @return index of the pattern found by the last successful
+                        find(), -1 if none.
+            */
+            int matched() const { return mMatched; }
+            /** Forgets any partial match and the last match. */
+            void reset() { mState = 0; mMatched = -1; }
+        private:
+            // mNext[state*256 + byte]
+            std::vector<std::uint32_t>  mNext;
+            // pattern ending in each state, -1 if none
+            std::vector<std::int32_t>   mOutput;
+            std::uint32_t               mState      = 0;
+            int                         mMatched    = -1;
+            int                         mSkipByte   = -1;
+        };
+    }
+}
+/** @endcond */
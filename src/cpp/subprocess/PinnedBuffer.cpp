@@ -0,0 +1,81 @@
+#include "PinnedBuffer.hpp"
+
+#include <cstring>
+
+#include "pipe.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <cerrno>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+using namespace subprocess::details;
+
+namespace {
+#ifdef _WIN32
+    char* allocate_pages(std::size_t size) {
+        void* memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (memory == nullptr)
+            throw subprocess::OSError("VirtualAlloc failed");
+        return (char*)memory;
+    }
+    void free_pages(char* memory, std::size_t) {
+        VirtualFree(memory, 0, MEM_RELEASE);
+    }
+#else
+    char* allocate_pages(std::size_t size) {
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw_os_error("mmap", errno);
+        return (char*)memory;
+    }
+    void free_pages(char* memory, std::size_t size) {
+        munmap(memory, size);
+    }
+#endif
+}
+
+namespace subprocess {
+    PinnedBuffer::PinnedBuffer(std::size_t size) {
+        if (size == 0)
+            return;
+        // mmap/VirtualAlloc hand out whole pages so alignment is implied
+        char* memory = allocate_pages(size);
+        mData = std::shared_ptr<char>(memory, [size](char* ptr) {
+            free_pages(ptr, size);
+        });
+        mSize = size;
+    }
+
+    PinnedBuffer::PinnedBuffer(std::string_view data) : PinnedBuffer(data.size()) {
+        if (!data.empty())
+            std::memcpy(mData.get(), data.data(), data.size());
+    }
+
+    ssize_t pipe_write_pinned(PipeHandle handle, const PinnedBuffer& buffer) {
+        const char* data = buffer.data();
+        std::size_t size = buffer.size();
+        std::size_t pos  = 0;
+#ifdef __linux__
+        while (pos < size) {
+            struct iovec iov;
+            iov.iov_base = const_cast<char*>(data + pos);
+            iov.iov_len  = size - pos;
+            ssize_t transfered = vmsplice(handle, &iov, 1, SPLICE_F_GIFT);
+            if (transfered < 0 && errno == EINTR)
+                continue;
+            if (transfered < 0 && errno == EPIPE)
+                return pos;
+            if (transfered <= 0)
+                break; // not a pipe or unsupported, write() the rest
+            pos += transfered;
+        }
+#endif
+        return pos + pipe_write_all(handle, data + pos, size - pos);
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+#include "basic_types.hpp"
+
+namespace subprocess {
+    /** Page aligned, immutable-once-shared memory for feeding large inputs
+        to a child's cin.
+
+        On linux the pages are handed to the pipe with vmsplice() instead of
+        being copied by write(). The kernel then references the memory
+        directly until the child has read it, so there is a contract:
+
+        - Once the buffer is passed as cin the contents must not be modified.
+        - The library keeps its own reference to the buffer until the process
+          has been waited for (Popen::wait() or Popen::close()), so dropping
+          your copy early is fine.
+
+        Copies are cheap and share the same memory.
+    */
+    class PinnedBuffer {
+    public:
+        PinnedBuffer(){}
+        /** Allocates size bytes of page aligned memory for you to fill. */
+        explicit PinnedBuffer(std::size_t size);
+        /** Allocates page aligned memory and copies data into it. */
+        explicit PinnedBuffer(std::string_view data);
+
+        char*       data()          { return mData.get(); }
+        const char* data() const    { return mData.get(); }
+        std::size_t size() const    { return mSize; }
+        bool        empty() const   { return mSize == 0; }
+
+        /** Releases this reference to the memory. */
+        void reset() { mData.reset(); mSize = 0; }
+    private:
+        std::shared_ptr<char>   mData;
+        std::size_t             mSize = 0;
+    };
+
+    /** Writes the entire buffer to the pipe.
+
+        On linux vmsplice(SPLICE_F_GIFT) is used to avoid copying the pages.
+        If the kernel refuses (not a pipe, unsupported) it falls back to
+        pipe_write() transparently. Blocks until everything has been written
+        or the pipe is broken.
+
+        @returns number of bytes written.
+    */
+    ssize_t pipe_write_pinned(PipeHandle handle, const PinnedBuffer& buffer);
+}
@@ -1,25 +1,84 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <string>
 #include <variant>
 #include <iostream>
 #include <cstdio>
 
 #include "basic_types.hpp"
+#include "PinnedBuffer.hpp"
+#include "OutputSink.hpp"
+#include "MemoryCapture.hpp"
+#include "Broadcast.hpp"
 
 
 namespace subprocess {
+    /** How the child opens the path of a FileRedirect */
+    enum class FileMode {
+        read,       ///< Open an existing file for reading.
+        write,      ///< Open for writing, created if missing. Not truncated.
+        append,     ///< Open for appending, created if missing.
+        truncate    ///< Open for writing, created if missing and truncated.
+    };
+
+    /** Redirects a stream to a file which the child opens itself. Unlike
+        passing a FILE* or handle there is no file descriptor opened in the
+        parent and no thread copying the data.
+
+        e.g. `RunBuilder(cmd).cout(FileRedirect{"log.txt", FileMode::append})`
+    */
+    struct FileRedirect {
+        std::string path;
+        FileMode    mode = FileMode::truncate;
+    };
+
+    /** Produces cin on demand. Fills buffer with up to size bytes and
+        returns how many, 0 at the end.
+
+        It's called from a thread of its own, only once the child's pipe has
+        room for more, so input is produced as fast as the child reads it
+        and at most about a pipe buffer and a chunk ahead. Whatever it uses
+        must outlive the child's reading. If it throws, or the child closes
+        cin, it isn't called again and the child sees the end of its input.
+
+        e.g. sorting a million lines without holding them in memory first
+        @code
+            int next = 0;
+            InputGenerator lines = [&next](char* buffer, std::size_t size) {
+                std::size_t used = 0;
+                while (next < 1000000 && size - used >= 16)
+                    used += std::snprintf(buffer + used, size - used, "%d\n", next++);
+                return used;
+            };
+            auto sorted = RunBuilder({"sort", "-n"}).cin(lines)
+                .cout(PipeOption::pipe).run();
+        @endcode
+    */
+    typedef std::function<std::size_t(char* buffer, std::size_t size)> InputGenerator;
+
     enum class PipeVarIndex {
         option,
         string,
         handle,
         istream,
         ostream,
-        file
+        file,
+        pinned,
+        path,
+        callback,
+        sink,
+        memory,
+        broadcast,
+        generator
     };
 
     typedef std::variant<PipeOption, std::string, PipeHandle,
-        std::istream*, std::ostream*, FILE*> PipeVar;
+        std::istream*, std::ostream*, FILE*, PinnedBuffer,
+        FileRedirect, ChunkCallback, std::shared_ptr<OutputSink>,
+        std::shared_ptr<MemoryCapture>, std::shared_ptr<Broadcast>,
+        InputGenerator> PipeVar;
 
 
     inline PipeOption get_pipe_option(const PipeVar& option) {
@@ -28,6 +87,8 @@ namespace subprocess {
         switch(index) {
         case PipeVarIndex::option:  return std::get<PipeOption>(option);
         case PipeVarIndex::handle:  return PipeOption::specific;
+        case PipeVarIndex::path:    return PipeOption::path;
+        case PipeVarIndex::memory:  return PipeOption::specific;
 
         default:                    return PipeOption::pipe;
         }
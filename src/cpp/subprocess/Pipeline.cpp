@@ -0,0 +1,201 @@
+#include "Pipeline.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+
+#include "simd.hpp"
+#include "SigPipeGuard.hpp"
+
+using subprocess::details::find_byte;
+
+namespace {
+    using subprocess::PipeHandle;
+    using subprocess::kBadPipeValue;
+
+    void close_all(std::vector<PipeHandle>& handles) {
+        for (PipeHandle& handle : handles) {
+            if (handle != kBadPipeValue)
+                subprocess::pipe_close(handle);
+            handle = kBadPipeValue;
+        }
+    }
+
+    void run_function(const subprocess::PipelineFunction& function, PipeHandle input,
+        PipeHandle output, std::exception_ptr& error) {
+        subprocess::details::block_sigpipe_on_this_thread();
+        try {
+            function(input, output);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // the neighbours see the end
+        if (input != kBadPipeValue)
+            subprocess::pipe_close(input);
+        if (output != kBadPipeValue)
+            subprocess::pipe_close(output);
+    }
+}
+
+namespace subprocess {
+    Pipeline::~Pipeline() {
+        if (!mStarted)
+            return;
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+    Pipeline& Pipeline::add(CommandLine command, RunOptions options) {
+        if (mStarted)
+            throw std::runtime_error("Pipeline: already started");
+        mStages.push_back({std::move(command), std::move(options), nullptr});
+        return *this;
+    }
+
+    Pipeline& Pipeline::add(PipelineFunction function) {
+        if (mStarted)
+            throw std::runtime_error("Pipeline: already started");
+        if (!function)
+            throw std::invalid_argument("Pipeline: function is empty");
+        mStages.push_back({{}, {}, std::move(function)});
+        return *this;
+    }
+
+    void Pipeline::start() {
+        if (mStarted)
+            throw std::runtime_error("Pipeline: already started");
+        if (mStages.empty())
+            throw std::invalid_argument("Pipeline: no stages");
+        mStarted = true;
+        const std::size_t count = mStages.size();
+        mErrors.resize(count);
+        // stage i reads inputs[i] and writes outputs[i]
+        std::vector<PipeHandle> inputs(count, kBadPipeValue);
+        std::vector<PipeHandle> outputs(count, kBadPipeValue);
+        try {
+            for (std::size_t i = 1; i < count; ++i) {
+                // not inheritable, so no child holds another's end open
+                PipePair pair = pipe_create(false);
+                inputs[i] = pair.input;
+                outputs[i - 1] = pair.output;
+                pair.disown();
+            }
+            for (std::size_t i = 0; i < count; ++i) {
+                Stage& stage = mStages[i];
+                if (stage.function) {
+                    mThreads.emplace_back(run_function, std::cref(stage.function),
+                        inputs[i], outputs[i], std::ref(mErrors[i]));
+                    // the thread closes them
+                    inputs[i] = outputs[i] = kBadPipeValue;
+                    continue;
+                }
+                if (i > 0)
+                    stage.options.cin = inputs[i];
+                if (i + 1 < count)
+                    stage.options.cout = outputs[i];
+                mProcesses.emplace_back(stage.command, std::move(stage.options));
+                // the child has its own copies
+                if (inputs[i] != kBadPipeValue)
+                    pipe_close(inputs[i]);
+                if (outputs[i] != kBadPipeValue)
+                    pipe_close(outputs[i]);
+                inputs[i] = outputs[i] = kBadPipeValue;
+            }
+        } catch (...) {
+            // the started stages see their neighbours end
+            close_all(inputs);
+            close_all(outputs);
+            try {
+                wait();
+            } catch (...) {
+            }
+            throw;
+        }
+    }
+
+    void Pipeline::wait() {
+        for (std::thread& thread : mThreads) {
+            if (thread.joinable())
+                thread.join();
+        }
+        for (Popen& process : mProcesses)
+            process.wait();
+        for (std::exception_ptr& error : mErrors) {
+            if (error)
+                std::rethrow_exception(error);
+        }
+    }
+
+    CompletedProcess Pipeline::run(bool check) {
+        if (!mStarted)
+            start();
+        CompletedProcess completed;
+        std::exception_ptr error;
+        if (!mProcesses.empty()) {
+            try {
+                completed = subprocess::run(mProcesses.back(), check);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        wait();
+        if (error)
+            std::rethrow_exception(error);
+        return completed;
+    }
+
+    PipelineFunction Pipeline::head_bytes(std::size_t count) {
+        return [count](PipeHandle input, PipeHandle output) {
+            pipe_splice_all(input, output, count);
+        };
+    }
+
+    PipelineFunction Pipeline::head(std::size_t count) {
+        return [count](PipeHandle input, PipeHandle output) {
+            std::size_t remaining = count;
+            std::vector<char> buffer(64*1024);
+            while (remaining > 0) {
+                ssize_t transfered = pipe_read(input, &buffer[0], buffer.size());
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+                if (transfered <= 0)
+                    break;
+                const char* begin = &buffer[0];
+                const char* end = begin + transfered;
+                const char* pos = begin;
+                while (remaining > 0) {
+                    const char* newline = find_byte(pos, end, '\n');
+                    if (newline == end)
+                        break;
+                    pos = newline + 1;
+                    --remaining;
+                }
+                std::size_t size = remaining == 0? pos - begin : transfered;
+                if (pipe_write_all(output, begin, size) < size)
+                    break;
+            }
+        };
+    }
+
+    PipelineFunction Pipeline::transform(TransformStages stages) {
+        return [stages(std::move(stages))](PipeHandle input, PipeHandle output) {
+            bool failed = false;
+            details::TransformPipeline pipeline(stages, [&](std::string_view chunk) {
+                if (!failed && pipe_write_all(output, chunk.data(), chunk.size()) < chunk.size())
+                    failed = true;
+            });
+            std::vector<char> buffer(64*1024);
+            while (!failed) {
+                ssize_t transfered = pipe_read(input, &buffer[0], buffer.size());
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+                if (transfered <= 0)
+                    break;
+                pipeline.write(&buffer[0], transfered);
+            }
+            if (!failed)
+                pipeline.finish();
+        };
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "ProcessBuilder.hpp"
+
+namespace subprocess {
+    /** An in process stage of a Pipeline. Reads from input and writes to
+        output until it's done, both are closed once it returns. The first
+        stage gets kBadPipeValue as input, the last kBadPipeValue as output.
+
+        Closing input early, e.g. returning, ends the previous command like
+        `head` does in a shell. SIGPIPE is blocked on its thread, a write to
+        a next command that exited fails with EPIPE instead.
+    */
+    typedef std::function<void(PipeHandle input, PipeHandle output)> PipelineFunction;
+
+    /** Commands chained like a shell pipeline, each cout feeding the next
+        cin, where trivial stages can be functions in this process instead
+        of helper executables. That saves a fork/exec and copying through
+        one more pipe.
+        @code
+            // cat access.log | grep -F ' 404 ' | head -n 10 | sort
+            CompletedProcess completed = Pipeline()
+                .add({"cat", "access.log"})
+                .add(Pipeline::transform({LineFilter::containing(" 404 ")}))
+                .add(Pipeline::head(10))
+                .add(RunBuilder({"sort"}).cout(PipeOption::pipe))
+                .run();
+        @endcode
+
+        Stages are connected with pipes. Functions run on a thread each and
+        can move data between their pipes with pipe_splice(), which on linux
+        never copies it into this process, e.g. head_bytes().
+    */
+    class Pipeline {
+    public:
+        Pipeline(){}
+        /** Waits for the stages if started, ignoring their errors. */
+        ~Pipeline();
+        Pipeline(const Pipeline&)=delete;
+        Pipeline& operator=(const Pipeline&)=delete;
+
+        /** Adds a command. Its options.cin is replaced with the previous
+            stage's output, unless it's the first, and options.cout with the
+            next stage's input, unless it's the last.
+
+            @throw std::runtime_error if already started.
+        */
+        Pipeline& add(CommandLine command, RunOptions options);
+        /** Adds builder's command and options, or just a command with
+            `add({"grep", "-v", "x"})`.
+        */
+        Pipeline& add(const RunBuilder& builder) {
+            return add(builder.command, builder.options);
+        }
+        Pipeline& add(PipelineFunction function);
+
+        /** Starts every stage.
+
+            @throw std::runtime_error if already started.
+            @throw std::invalid_argument if there are no stages.
+            @throw what starting a command throws. Stages started before
+                   are waited for.
+        */
+        void start();
+        /** The Popen of every command stage in order, once started. */
+        std::vector<Popen>& processes() { return mProcesses; }
+        /** Waits for all stages.
+
+            @throw the first exception a function threw, if any.
+        */
+        void wait();
+        /** Starts if not yet started, runs the last command with
+            subprocess::run() and waits for the other stages.
+
+            @return the last command's CompletedProcess.
+
+            @throw CalledProcessError if check and the last command failed.
+            @throw what subprocess::run() or a function threw.
+        */
+        CompletedProcess run(bool check=false);
+
+        /** Passes on the first count bytes, like head -c, with
+            pipe_splice_all().
+        */
+        static PipelineFunction head_bytes(std::size_t count);
+        /** Passes on the first count lines, like head -n. */
+        static PipelineFunction head(std::size_t count);
+        /** Passes everything through stages, e.g. a LineFilter in place of
+            grep.
+        */
+        static PipelineFunction transform(TransformStages stages);
+    private:
+        struct Stage {
+            CommandLine         command;
+            RunOptions          options;
+            PipelineFunction    function;
+        };
+        std::vector<Stage>              mStages;
+        std::vector<Popen>              mProcesses;
+        std::vector<std::thread>        mThreads;
+        // one per stage, set by the function stages' threads
+        std::vector<std::exception_ptr> mErrors;
+        bool                            mStarted = false;
+    };
+}
@@ -13,8 +13,10 @@
 #include <csignal>
 #endif
 
+#include <atomic>
 #include <iterator>
 #include <sstream>
+#include <exception>
 #include <thread>
 #include <mutex>
 #include <chrono>
@@ -23,6 +25,9 @@
 
 #include "shell_utils.hpp"
 #include "utf8_to_utf16.hpp"
+#include "PatternMatcher.hpp"
+#include "Digest.hpp"
+#include "SigPipeGuard.hpp"
 
 
 using std::nullptr_t;
@@ -47,23 +52,22 @@ namespace subprocess {
         }
     }
     double monotonic_seconds() {
-        static bool needs_init = true;
-        static std::chrono::steady_clock::time_point begin;
-        static double last_value = 0;
-        if (needs_init) {
-            begin = std::chrono::steady_clock::now();
-            needs_init = false;
-        }
+        // called from any thread, e.g. pipe_poll()
+        static const auto begin = std::chrono::steady_clock::now();
+        static std::atomic<double> last_value{0};
         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
         std::chrono::duration<double> duration = now - begin;
         double result = duration.count();
 
         // some OS's have bugs and not exactly monotonic. Or perhaps there is
         // floating point errors or something. I don't know.
-        if (result < last_value)
-            return last_value;
-        last_value = result;
-        return result;
+        double last = last_value.load();
+        while (true) {
+            if (result < last)
+                return last;
+            if (last_value.compare_exchange_weak(last, result))
+                return result;
+        }
     }
 
     double sleep_seconds(double seconds) {
@@ -89,60 +93,85 @@ namespace subprocess {
     private:
         PipeHandle mHandle;
     };
-    void pipe_thread(PipeHandle input, std::ostream* output) {
-        std::thread thread([=]() {
-            std::vector<char> buffer(2048);
+    /*  Copies input to output through the stages until the end of input. */
+    static void pipe_transformed(PipeHandle input, TransformStages& transforms,
+        std::function<void(std::string_view chunk)> output) {
+        std::vector<char> buffer(2048);
+        try {
+            details::TransformPipeline pipeline(std::move(transforms), std::move(output));
             while (true) {
                 ssize_t transfered = pipe_read(input, &buffer[0], buffer.size());
                 if (transfered <= 0)
                     break;
-                output->write(&buffer[0], transfered);
+                pipeline.write(&buffer[0], transfered);
             }
+            pipeline.finish();
+            return;
+        } catch (...) {
+            // nobody to report to on this thread
+        }
+        // the rest is discarded, the child must not block on a full pipe
+        while (true) {
+            ssize_t transfered = pipe_read(input, &buffer[0], buffer.size());
+#ifndef _WIN32
+            if (transfered < 0 && errno == EINTR)
+                continue;
+#endif
+            if (transfered <= 0)
+                break;
+        }
+    }
+    void pipe_thread(PipeHandle input, std::ostream* output, TransformStages transforms) {
+        std::thread thread([input, output, transforms(std::move(transforms))]() mutable {
+            pipe_transformed(input, transforms, [output](std::string_view chunk) {
+                output->write(chunk.data(), chunk.size());
+            });
         });
         thread.detach();
     }
 
-    void pipe_thread(PipeHandle input, FILE* output) {
-        std::thread thread([=]() {
-            std::vector<char> buffer(2048);
-            while (true) {
-                ssize_t transfered = pipe_read(input, &buffer[0], buffer.size());
-                if (transfered <= 0)
-                    break;
-                fwrite(&buffer[0], 1, transfered, output);
-            }
+    void pipe_thread(PipeHandle input, FILE* output, TransformStages transforms) {
+        std::thread thread([input, output, transforms(std::move(transforms))]() mutable {
+            pipe_transformed(input, transforms, [output](std::string_view chunk) {
+                fwrite(chunk.data(), 1, chunk.size(), output);
+            });
         });
         thread.detach();
     }
     void pipe_thread(FILE* input, PipeHandle output, bool bautoclose) {
         std::thread thread([=]() {
+            details::block_sigpipe_on_this_thread();
             AutoClosePipe autoclose(output, bautoclose);
             std::vector<char> buffer(2048);
             while (true) {
                 ssize_t transfered = fread(&buffer[0], 1, buffer.size(), input);
                 if (transfered <= 0)
                     break;
-                pipe_write(output, &buffer[0], transfered);
+                if (pipe_write_all(output, &buffer[0], transfered) < (std::size_t)transfered)
+                    break;
             }
         });
         thread.detach();
     }
     void pipe_thread(std::string& input, PipeHandle output, bool bautoclose) {
         std::thread thread([input(move(input)), output, bautoclose]() {
+            details::block_sigpipe_on_this_thread();
             AutoClosePipe autoclose(output, bautoclose);
-
-            std::size_t pos = 0;
-            while (pos < input.size()) {
-                ssize_t transfered = pipe_write(output, input.c_str()+pos, input.size() - pos);
-                if (transfered <= 0)
-                    break;
-                pos += transfered;
-            }
+            pipe_write_all(output, input.data(), input.size());
+        });
+        thread.detach();
+    }
+    void pipe_thread(PinnedBuffer input, PipeHandle output, bool bautoclose) {
+        std::thread thread([input, output, bautoclose]() {
+            details::block_sigpipe_on_this_thread();
+            AutoClosePipe autoclose(output, bautoclose);
+            pipe_write_pinned(output, input);
         });
         thread.detach();
     }
     void pipe_thread(std::istream* input, PipeHandle output, bool bautoclose) {
         std::thread thread([=]() {
+            details::block_sigpipe_on_this_thread();
             AutoClosePipe autoclose(output, bautoclose);
             std::vector<char> buffer(2048);
             while (true) {
@@ -155,26 +184,62 @@ namespace subprocess {
                         break;
                     continue;
                 }
-                pipe_write(output, &buffer[0], transfered);
+                if (pipe_write_all(output, &buffer[0], transfered) < (std::size_t)transfered)
+                    break;
+            }
+        });
+        thread.detach();
+    }
+    void pipe_thread(InputGenerator input, PipeHandle output, bool bautoclose) {
+        std::thread thread([input(std::move(input)), output, bautoclose]() {
+            // the child closing cin early only fails the write
+            details::block_sigpipe_on_this_thread();
+            AutoClosePipe autoclose(output, bautoclose);
+            constexpr std::size_t chunk_size = 64*1024;
+            std::unique_ptr<char[]> buffer(new char[chunk_size]);
+            PipePoll room = {output, kPipeWritable};
+            try {
+                while (true) {
+                    // nothing is produced until the child has room for it
+                    pipe_poll(&room, 1);
+                    if (room.ready & kPipeClosed)
+                        break;
+                    std::size_t size = std::min(input(buffer.get(), chunk_size), chunk_size);
+                    if (size == 0)
+                        break;
+                    if (pipe_write_all(output, buffer.get(), size) < size)
+                        break;
+                }
+            } catch (...) {
+                // nobody to report to on this thread, the child sees the end
             }
         });
         thread.detach();
     }
-    bool setup_redirect_stream(PipeHandle input, PipeVar& output) {
+    /*  The stages of an ostream or FILE* are taken by its thread. */
+    bool setup_redirect_stream(PipeHandle input, PipeVar& output, TransformStages& transforms) {
         PipeVarIndex index = static_cast<PipeVarIndex>(output.index());
 
         switch (index) {
-        // these 2 options are handled by the underlaying platform API
+        // these options are handled by the underlaying platform API
         case PipeVarIndex::handle:
+        case PipeVarIndex::path:
+        case PipeVarIndex::memory:
         case PipeVarIndex::option: break;
+        // serviced by run()
+        case PipeVarIndex::callback:
+        case PipeVarIndex::sink: break;
         case PipeVarIndex::string: // doesn't make sense
         case PipeVarIndex::istream: // doesn't make sense
+        case PipeVarIndex::pinned: // doesn't make sense
+        case PipeVarIndex::broadcast: // doesn't make sense
+        case PipeVarIndex::generator: // doesn't make sense
             throw std::domain_error("expected something to output to");
         case PipeVarIndex::ostream:
-            pipe_thread(input, std::get<std::ostream*>(output));
+            pipe_thread(input, std::get<std::ostream*>(output), std::move(transforms));
             break;
         case PipeVarIndex::file:
-            pipe_thread(input, std::get<FILE*>(output));
+            pipe_thread(input, std::get<FILE*>(output), std::move(transforms));
             break;
         }
         return false;
@@ -184,8 +249,9 @@ namespace subprocess {
         PipeVarIndex index = static_cast<PipeVarIndex>(input.index());
 
         switch (index) {
-        // these 2 options are handled by the underlaying platform API
+        // these options are handled by the underlaying platform API
         case PipeVarIndex::handle:
+        case PipeVarIndex::path:
 		case PipeVarIndex::option: break;
         case PipeVarIndex::string:
             pipe_thread(std::get<std::string>(input), output, true);
@@ -195,12 +261,38 @@ namespace subprocess {
 			return true;
 		case PipeVarIndex::ostream:
             throw std::domain_error("reading from std::ostream doesn't make sense");
+        case PipeVarIndex::callback:
+        case PipeVarIndex::sink:
+        case PipeVarIndex::memory:
+            throw std::domain_error("reading from an output sink doesn't make sense");
         case PipeVarIndex::file:
             pipe_thread(std::get<FILE*>(input), output, true);
 			return true;
+        case PipeVarIndex::pinned:
+            pipe_thread(std::get<PinnedBuffer>(input), output, true);
+            return true;
+        case PipeVarIndex::broadcast:
+            // fed by Broadcast::start() together with its other children
+            std::get<std::shared_ptr<Broadcast>>(input)->add(output);
+            return true;
+        case PipeVarIndex::generator:
+            pipe_thread(std::move(std::get<InputGenerator>(input)), output, true);
+            return true;
 		}
 		return false;
     }
+    static PipeHandle specific_output_handle(const PipeVar& output) {
+        if (auto memory = std::get_if<std::shared_ptr<MemoryCapture>>(&output))
+            return *memory? (*memory)->handle() : kBadPipeValue;
+        return std::get<PipeHandle>(output);
+    }
+    static std::shared_ptr<OutputSink> make_output_sink(PipeVar& output) {
+        if (auto callback = std::get_if<ChunkCallback>(&output))
+            return std::make_shared<CallbackSink>(std::move(*callback));
+        if (auto sink = std::get_if<std::shared_ptr<OutputSink>>(&output))
+            return *sink;
+        return nullptr;
+    }
     Popen::Popen(CommandLine command, const RunOptions& optionsIn) {
         // we have to make a copy because of const
         RunOptions options = optionsIn;
@@ -211,42 +303,132 @@ namespace subprocess {
         RunOptions options = std::move(optionsIn);
         init(command, options);
     }
+    /*  @return true if run() reads what the child writes to output. */
+    static bool read_by_run(const PipeVar& output) {
+        switch (static_cast<PipeVarIndex>(output.index())) {
+        case PipeVarIndex::option:
+            return std::get<PipeOption>(output) == PipeOption::pipe;
+        case PipeVarIndex::callback:
+        case PipeVarIndex::sink:
+            return true;
+        default:
+            return false;
+        }
+    }
+    /*  Digesting output that would go to /dev/null means reading it, the
+        stream is piped and drained into a sink dropping it.
+    */
+    static void drain_for_digest(PipeVar& output, int digest, const char* name) {
+        if (digest == 0)
+            return;
+        auto option = std::get_if<PipeOption>(&output);
+        if (option && *option == PipeOption::devnull) {
+            output = ChunkCallback([](std::string_view) {});
+            return;
+        }
+        if (!read_by_run(output)) {
+            throw std::invalid_argument(std::string("Popen constructor: ") + name
+                + " must be read by run() to be digested");
+        }
+    }
+    /*  Same for transforming, which a std::ostream or FILE* thread can do
+        as well.
+    */
+    static void drain_for_transforms(PipeVar& output, const TransformStages& transforms,
+        const char* name) {
+        if (transforms.empty())
+            return;
+        auto option = std::get_if<PipeOption>(&output);
+        if (option && *option == PipeOption::devnull) {
+            output = ChunkCallback([](std::string_view) {});
+            return;
+        }
+        if (!read_by_run(output) && !std::holds_alternative<std::ostream*>(output)
+            && !std::holds_alternative<FILE*>(output)) {
+            throw std::invalid_argument(std::string("Popen constructor: ") + name
+                + " must be read by run() or be a std::ostream or FILE* to be transformed");
+        }
+    }
     void Popen::init(CommandLine& command, RunOptions& options) {
         ProcessBuilder builder;
 
+        drain_for_digest(options.cout, options.cout_digest, "cout");
+        drain_for_digest(options.cerr, options.cerr_digest, "cerr");
+        drain_for_transforms(options.cout, options.cout_transforms, "cout");
+        drain_for_transforms(options.cerr, options.cerr_transforms, "cerr");
+
         builder.cin_option  = get_pipe_option(options.cin);
         builder.cout_option = get_pipe_option(options.cout);
         builder.cerr_option = get_pipe_option(options.cerr);
 
+        if (std::holds_alternative<std::shared_ptr<MemoryCapture>>(options.cin))
+            throw std::domain_error("MemoryCapture can only be used for output");
         if (builder.cin_option == PipeOption::specific) {
             builder.cin_pipe = std::get<PipeHandle>(options.cin);
             if (builder.cin_pipe == kBadPipeValue)
                 throw std::invalid_argument("bad pipe value for cin");
         }
         if (builder.cout_option == PipeOption::specific) {
-            builder.cout_pipe = std::get<PipeHandle>(options.cout);
+            builder.cout_pipe = specific_output_handle(options.cout);
             if (builder.cout_pipe == kBadPipeValue)
                 throw std::invalid_argument("Popen constructor: bad pipe value for cout");
         }
         if (builder.cerr_option == PipeOption::specific) {
-            builder.cerr_pipe = std::get<PipeHandle>(options.cerr);
+            builder.cerr_pipe = specific_output_handle(options.cerr);
             if (builder.cout_pipe == kBadPipeValue)
                 throw std::invalid_argument("Popen constructor: bad pipe value for cout");
         }
+        if (builder.cin_option == PipeOption::path)
+            builder.cin_file = std::get<FileRedirect>(options.cin);
+        if (builder.cout_option == PipeOption::path) {
+            builder.cout_file = std::get<FileRedirect>(options.cout);
+            if (builder.cout_file.mode == FileMode::read)
+                throw std::domain_error("FileRedirect for cout must be opened for writing");
+        }
+        if (builder.cerr_option == PipeOption::path) {
+            builder.cerr_file = std::get<FileRedirect>(options.cerr);
+            if (builder.cerr_file.mode == FileMode::read)
+                throw std::domain_error("FileRedirect for cerr must be opened for writing");
+        }
+
+        for (const std::string& pattern : options.stop.patterns) {
+            if (pattern.empty())
+                throw std::invalid_argument("Popen constructor: empty stop pattern");
+        }
 
         builder.new_process_group = options.new_process_group;
         builder.env = options.env;
+        builder.pass_fds = options.pass_fds;
+        builder.socket_send_buffer = options.socket_send_buffer;
+        builder.socket_receive_buffer = options.socket_receive_buffer;
         builder.cwd = options.cwd;
 
         *this = builder.run_command(command);
 
+        // the child has its copy, don't leak it into other children
+        if (std::holds_alternative<std::shared_ptr<MemoryCapture>>(options.cout))
+            pipe_set_inheritable(builder.cout_pipe, false);
+        if (std::holds_alternative<std::shared_ptr<MemoryCapture>>(options.cerr))
+            pipe_set_inheritable(builder.cerr_pipe, false);
+
+        if (std::holds_alternative<PinnedBuffer>(options.cin)) {
+            // the pipe references these pages until the child reads them
+            cin_buffer = std::get<PinnedBuffer>(options.cin);
+        }
         cin_is_autoclosed = setup_redirect_stream(options.cin, cin);
         if (cin_is_autoclosed) {
             // ownership taken
             cin = kBadPipeValue;
         }
-        setup_redirect_stream(cout, options.cout);
-        setup_redirect_stream(cerr, options.cerr);
+        setup_redirect_stream(cout, options.cout, options.cout_transforms);
+        setup_redirect_stream(cerr, options.cerr, options.cerr_transforms);
+        cout_sink = make_output_sink(options.cout);
+        cerr_sink = make_output_sink(options.cerr);
+        stop = std::move(options.stop);
+        cout_digest = options.cout_digest;
+        cerr_digest = options.cerr_digest;
+        cout_transforms = std::move(options.cout_transforms);
+        cerr_transforms = std::move(options.cerr_transforms);
     }
 
     Popen::Popen(Popen&& other) {
@@ -259,6 +441,15 @@ namespace subprocess {
         cout = other.cout;
         cerr = other.cerr;
 		cin_is_autoclosed = other.cin_is_autoclosed;
+        cin_is_socket = other.cin_is_socket;
+        cin_buffer = std::move(other.cin_buffer);
+        cout_sink = std::move(other.cout_sink);
+        cerr_sink = std::move(other.cerr_sink);
+        stop = std::move(other.stop);
+        cout_digest = other.cout_digest;
+        cerr_digest = other.cerr_digest;
+        cout_transforms = std::move(other.cout_transforms);
+        cerr_transforms = std::move(other.cerr_transforms);
 
         pid = other.pid;
         returncode = other.returncode;
@@ -273,6 +464,7 @@ namespace subprocess {
         other.cout = kBadPipeValue;
         other.cerr = kBadPipeValue;
 		other.cin_is_autoclosed = false;
+        other.cin_is_socket = false;
         other.pid = 0;
         other.returncode = -1000;
         return *this;
@@ -289,6 +481,7 @@ namespace subprocess {
             pipe_close(cerr);
         cin = cout = cerr = kBadPipeValue;
 		cin_is_autoclosed = false;
+        cin_is_socket = false;
 
         // do this to not have zombie processes.
         if (pid) {
@@ -302,6 +495,13 @@ namespace subprocess {
         pid = 0;
         returncode = kBadReturnCode;
         args.clear();
+        cin_buffer.reset();
+        cout_sink.reset();
+        cerr_sink.reset();
+        stop = {};
+        cout_digest = cerr_digest = 0;
+        cout_transforms.clear();
+        cerr_transforms.clear();
     }
 #ifdef _WIN32
     std::string lastErrorString() {
@@ -489,28 +689,260 @@ namespace subprocess {
         return args;
     }
 
-    CompletedProcess run(Popen& popen, bool check) {
-        CompletedProcess completed;
+    /*  Where the output of one stream goes, and the stop patterns to look
+        for in it.
+    */
+    struct OutputTarget {
+        OutputSink*             sink;
+        std::string&            output;
+        std::size_t&            dropped;
+        details::PatternMatcher matcher;
+        StreamDigest            digest;
+        std::unique_ptr<details::TransformPipeline> transforms;
+
+        /*  @param digest_kinds DigestKind flags to digest the output with. */
+        OutputTarget(OutputSink* sink, std::string& output, std::size_t& dropped,
+            int digest_kinds)
+        : sink(sink), output(output), dropped(dropped), digest(digest_kinds) {}
+
+        /*  @param data     the read buffer, stages may change it in place.
+
+            @return true if a stop pattern matched, then only the output up
+            to and including the match has been delivered.
+        */
+        bool write(char* data, std::size_t size) {
+            std::size_t end = matcher.find(std::string_view(data, size));
+            if (end != details::PatternMatcher::npos)
+                size = end;
+            if (transforms)
+                transforms->write(data, size);
+            else
+                deliver(std::string_view(data, size));
+            return end != details::PatternMatcher::npos;
+        }
+        void deliver(std::string_view chunk) {
+            // while the chunk is hot in cache
+            if (digest.kinds())
+                digest.update(chunk);
+            if (sink)
+                sink->write(chunk);
+            else
+                output.append(chunk);
+        }
+        void finish() {
+            if (transforms)
+                transforms->finish();
+            if (sink) {
+                sink->finish();
+                sink->collect(output, dropped);
+            }
+        }
+        /*  Reads the next chunk. A sink copying straight from the pipe goes
+            first, then exactly what it copied is read so both stay in step.
+        */
+        ssize_t read(PipeHandle handle, std::vector<char>& buffer) {
+            std::size_t copied = 0;
+            // what a sink copies must be exactly what it is written
+            if (sink && matcher.empty() && !transforms)
+                copied = sink->copy_from(handle, buffer.size());
+            if (copied == 0)
+                return pipe_read(handle, &buffer[0], buffer.size());
+            std::size_t pos = 0;
+            while (pos < copied) {
+                ssize_t transfered = pipe_read(handle, &buffer[pos], copied - pos);
+#ifndef _WIN32
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+#endif
+                if (transfered <= 0)
+                    break;
+                pos += transfered;
+            }
+            return pos;
+        }
+    };
+
+    /*  Sends the stop signals in turn, giving the process grace seconds to
+        exit after each one.
+    */
+    static void stop_process(Popen& popen) {
+        const StopOnMatch& stop = popen.stop;
+        for (std::size_t i = 0; i < stop.signals.size(); ++i) {
+            if (popen.poll())
+                return;
+            popen.send_signal(stop.signals[i]);
+            if (i + 1 == stop.signals.size())
+                break;
+            StopWatch watch;
+            while (watch.seconds() < stop.grace) {
+                if (popen.poll())
+                    return;
+                sleep_seconds(0.001);
+            }
+        }
+    }
+
+    /*  Reads the pipe until end of file, or until a stop pattern matches
+        in this stream or another one, which sets matched.
+
+        @return true if this stream matched first.
+    */
+    static bool read_output(PipeHandle handle, OutputTarget& target,
+        std::atomic<int>& matched) {
+        if (target.sink == nullptr && target.matcher.empty() && !target.digest.kinds()
+            && !target.transforms) {
+            target.output = pipe_read_all(handle);
+            return false;
+        }
+        bool first = false;
+        // the sink doesn't own this, it's reused for every chunk
+        std::vector<char> buffer(64*1024);
+        while (true) {
+            ssize_t transfered = target.read(handle, buffer);
+            if (transfered <= 0 || matched.load() >= 0)
+                break;
+            if (target.write(&buffer[0], transfered)) {
+                int none = -1;
+                first = matched.compare_exchange_strong(none, target.matcher.matched());
+                break;
+            }
+        }
+        target.finish();
+        return first;
+    }
+#ifndef _WIN32
+    /*  read_outputs() for when both cout & cerr are pipes. One poll() loop
+        instead of a thread per stream, so chunks reach the sinks in the
+        order they were read.
+    */
+    static std::exception_ptr poll_outputs(Popen& popen, OutputTarget (&targets)[2],
+        std::atomic<int>& matched) {
+        struct Stream {
+            PipeHandle&     handle;
+            OutputTarget&   target;
+        };
+        Stream streams[2] = {
+            {popen.cout, targets[0]},
+            {popen.cerr, targets[1]}
+        };
+        std::exception_ptr error;
+        std::vector<char> buffer(64*1024);
+        while (popen.cout != kBadPipeValue || popen.cerr != kBadPipeValue) {
+            // closed streams are kBadPipeValue, which pipe_poll() skips
+            PipePoll entries[2] = {
+                {popen.cout, kPipeReadable},
+                {popen.cerr, kPipeReadable}
+            };
+            pipe_poll(entries, 2);
+            for (int i = 0; i < 2 && matched.load() < 0; ++i) {
+                if (entries[i].ready == 0)
+                    continue;
+                Stream& stream = streams[i];
+                ssize_t transfered = stream.target.read(stream.handle, buffer);
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+                try {
+                    if (transfered > 0) {
+                        if (stream.target.write(&buffer[0], transfered))
+                            matched = stream.target.matcher.matched();
+                        continue;
+                    }
+                    stream.target.finish();
+                } catch (...) {
+                    if (!error)
+                        error = std::current_exception();
+                }
+                pipe_close(stream.handle);
+                stream.handle = kBadPipeValue;
+            }
+            if (matched.load() < 0)
+                continue;
+            // stop reading, whatever is still open ends here
+            for (Stream& stream : streams) {
+                if (stream.handle == kBadPipeValue)
+                    continue;
+                try {
+                    stream.target.finish();
+                } catch (...) {
+                    if (!error)
+                        error = std::current_exception();
+                }
+                pipe_close(stream.handle);
+                stream.handle = kBadPipeValue;
+            }
+            stop_process(popen);
+            break;
+        }
+        return error;
+    }
+#endif
+    /*  Reads cout & cerr of popen to completion, either into completed or the
+        sinks of popen. If a sink throws the exception is returned so it can
+        be rethrown once the process has been waited for.
+    */
+    static std::exception_ptr read_outputs(Popen& popen, CompletedProcess& completed) {
+        OutputTarget targets[2] = {
+            {popen.cout_sink.get(), completed.cout, completed.cout_dropped, popen.cout_digest},
+            {popen.cerr_sink.get(), completed.cerr, completed.cerr_dropped, popen.cerr_digest}
+        };
+        if (!popen.stop.patterns.empty()) {
+            targets[0].matcher = details::PatternMatcher(popen.stop.patterns);
+            targets[1].matcher = targets[0].matcher;
+        }
+        const TransformStages* transforms[2] = {&popen.cout_transforms, &popen.cerr_transforms};
+        for (int i = 0; i < 2; ++i) {
+            if (transforms[i]->empty())
+                continue;
+            OutputTarget& target = targets[i];
+            target.transforms = std::make_unique<details::TransformPipeline>(*transforms[i],
+                [&target](std::string_view chunk) { target.deliver(chunk); });
+        }
+        std::atomic<int> matched{-1};
+#ifndef _WIN32
+        if (popen.cout != kBadPipeValue && popen.cerr != kBadPipeValue) {
+            std::exception_ptr error = poll_outputs(popen, targets, matched);
+            completed.matched = matched;
+            completed.cout_digest = targets[0].digest.result();
+            completed.cerr_digest = targets[1].digest.result();
+            return error;
+        }
+#endif
+        std::exception_ptr cout_error;
+        std::exception_ptr cerr_error;
         std::thread cout_thread;
         std::thread cerr_thread;
         if (popen.cout != kBadPipeValue) {
             cout_thread = std::thread([&]() {
                 try {
-                    completed.cout = pipe_read_all(popen.cout);
+                    bool stopper = read_output(popen.cout, targets[0], matched);
+                    pipe_close(popen.cout);
+                    popen.cout = kBadPipeValue;
+                    if (stopper)
+                        stop_process(popen);
                 } catch (...) {
+                    cout_error = std::current_exception();
+                }
+                if (popen.cout != kBadPipeValue) {
+                    pipe_close(popen.cout);
+                    popen.cout = kBadPipeValue;
                 }
-                pipe_close(popen.cout);
-                popen.cout = kBadPipeValue;
             });
         }
         if (popen.cerr != kBadPipeValue) {
             cerr_thread = std::thread([&]() {
                 try {
-                    completed.cerr = pipe_read_all(popen.cerr);
+                    bool stopper = read_output(popen.cerr, targets[1], matched);
+                    pipe_close(popen.cerr);
+                    popen.cerr = kBadPipeValue;
+                    if (stopper)
+                        stop_process(popen);
                 } catch (...) {
+                    cerr_error = std::current_exception();
+                }
+                if (popen.cerr != kBadPipeValue) {
+                    pipe_close(popen.cerr);
+                    popen.cerr = kBadPipeValue;
                 }
-                pipe_close(popen.cerr);
-                popen.cerr = kBadPipeValue;
             });
         }
 
@@ -520,16 +952,29 @@ namespace subprocess {
         if (cerr_thread.joinable()) {
             cerr_thread.join();
         }
+        completed.matched = matched;
+        completed.cout_digest = targets[0].digest.result();
+        completed.cerr_digest = targets[1].digest.result();
+        return cout_error? cout_error : cerr_error;
+    }
+
+    CompletedProcess run(Popen& popen, bool check) {
+        CompletedProcess completed;
+        std::exception_ptr sink_error = read_outputs(popen, completed);
 
         popen.wait();
+        if (sink_error)
+            std::rethrow_exception(sink_error);
         completed.returncode = popen.returncode;
         completed.args = CommandLine(popen.args.begin()+1, popen.args.end());
-        if (check) {
+        if (check && completed.returncode != 0 && completed.matched < 0) {
             CalledProcessError error("failed to execute " + popen.args[0]);
             error.cmd           = popen.args;
             error.returncode    = completed.returncode;
             error.cout          = std::move(completed.cout);
             error.cerr          = std::move(completed.cerr);
+            error.cout_dropped  = completed.cout_dropped;
+            error.cerr_dropped  = completed.cerr_dropped;
             throw error;
         }
         return completed;
@@ -538,35 +983,7 @@ namespace subprocess {
     CompletedProcess run(CommandLine command, RunOptions options) {
         Popen popen(command, std::move(options));
         CompletedProcess completed;
-        std::thread cout_thread;
-        std::thread cerr_thread;
-        if (popen.cout != kBadPipeValue) {
-            cout_thread = std::thread([&]() {
-                try {
-                    completed.cout = pipe_read_all(popen.cout);
-                } catch (...) {
-                }
-                pipe_close(popen.cout);
-                popen.cout = kBadPipeValue;
-            });
-        }
-        if (popen.cerr != kBadPipeValue) {
-            cerr_thread = std::thread([&]() {
-                try {
-                    completed.cerr = pipe_read_all(popen.cerr);
-                } catch (...) {
-                }
-                pipe_close(popen.cerr);
-                popen.cerr = kBadPipeValue;
-            });
-        }
-
-        if (cout_thread.joinable()) {
-            cout_thread.join();
-        }
-        if (cerr_thread.joinable()) {
-            cerr_thread.join();
-        }
+        std::exception_ptr sink_error = read_outputs(popen, completed);
 
         try {
             popen.wait(options.timeout);
@@ -579,20 +996,36 @@ namespace subprocess {
             timeout.timeout = options.timeout;
             timeout.cout = std::move(completed.cout);
             timeout.cerr = std::move(completed.cerr);
+            timeout.cout_dropped = completed.cout_dropped;
+            timeout.cerr_dropped = completed.cerr_dropped;
             throw timeout;
         }
+        if (sink_error)
+            std::rethrow_exception(sink_error);
 
         completed.returncode = popen.returncode;
         completed.args = command;
-        if (options.check && completed.returncode != 0) {
+        if (options.check && completed.returncode != 0 && completed.matched < 0) {
             CalledProcessError error("failed to execute " + command[0]);
             error.cmd           = command;
             error.returncode    = completed.returncode;
             error.cout          = std::move(completed.cout);
             error.cerr          = std::move(completed.cerr);
+            error.cout_dropped  = completed.cout_dropped;
+            error.cerr_dropped  = completed.cerr_dropped;
             throw error;
         }
         return completed;
     }
 
+    CompletedProcess run(CommandLine command, std::string& cout,
+        std::string& cerr, RunOptions options) {
+        options.cout = std::make_shared<AppendCapture>(cout);
+        // same string, let the child merge them so only one thread appends
+        if (&cout == &cerr)
+            options.cerr = PipeOption::cout;
+        else
+            options.cerr = std::make_shared<AppendCapture>(cerr);
+        return run(std::move(command), std::move(options));
+    }
 }
@@ -6,6 +6,7 @@
 
 #include "pipe.hpp"
 #include "PipeVar.hpp"
+#include "Transform.hpp"
 
 namespace subprocess {
 
@@ -21,23 +22,56 @@ namespace subprocess {
             RunOptions
     */
 
+    /** Stops a process once it prints one of the patterns.
+
+        Useful for probes and health checks that only need to run until a
+        marker such as "READY" shows up.
+    */
+    struct StopOnMatch {
+        /** Literals to look for in cout & cerr. Each stream is searched
+            separately, a match can span reads. Empty means never stop.
+        */
+        std::vector<std::string> patterns;
+        /** Sent in turn until the process exits. Empty only stops reading. */
+#ifdef _WIN32
+        std::vector<int> signals = {PSIGKILL};
+#else
+        std::vector<int> signals = {PSIGTERM, PSIGKILL};
+#endif
+        /** Seconds to wait for the process to exit before the next signal. */
+        double grace = 1.0;
+    };
+
     struct RunOptions {
         /** Option for cin, data to pipe to cin.  or created handle to use.
 
             if a pipe handle is used it will be made inheritable automatically
             when process is created and closed on the parents end.
+
+            For large inputs use a PinnedBuffer, its pages are spliced into
+            the pipe instead of being copied.
+            To feed the same input to many children use a Broadcast.
+            To produce input as the child reads it use an InputGenerator.
         */
         PipeVar     cin     = PipeOption::inherit;
         /** Option for cout, or handle to use.
 
             if a pipe handle is used it will be made inheritable automatically
             when process is created and closed on the parents end.
+
+            A ChunkCallback or OutputSink receives the output incrementally
+            from run() instead of it being captured. With a MemoryCapture the
+            child writes directly into an in memory file.
         */
         PipeVar     cout    = PipeOption::inherit;
         /** Option for cout, or handle to use.
 
             if a pipe handle is used it will be made inheritable automatically
             when process is created and closed on the parents end.
+
+            A ChunkCallback or OutputSink receives the output incrementally
+            from run() instead of it being captured. With a MemoryCapture the
+            child writes directly into an in memory file.
         */
         PipeVar     cerr    = PipeOption::inherit;
 
@@ -58,8 +92,50 @@ namespace subprocess {
         bool        check   = false;
         /** If empty inherits from current process */
         EnvMap      env;
+        /** SO_SNDBUF of the parent's end of PipeOption::socketpair channels,
+            and SO_RCVBUF of the child's. 0 keeps the system default.
+        */
+        int         socket_send_buffer      = 0;
+        /** SO_RCVBUF of the parent's end of PipeOption::socketpair channels,
+            and SO_SNDBUF of the child's. 0 keeps the system default.
+        */
+        int         socket_receive_buffer   = 0;
+        /** Extra handles for the child, keyed by the fd number they get in
+            the child, which must be 3 or more. e.g. a control pipe as fd 3.
 
-
+            When not empty every other fd above 2 is closed in the child,
+            whether inheritable or not. The parent keeps ownership of the
+            handles. Only supported on posix.
+        */
+        FdMap       pass_fds;
+        /** Only for subprocess::run(). Once a pattern is read from a piped
+            cout or cerr, reading stops and the process is signaled. The
+            output up to and including the match is returned and
+            CompletedProcess::matched tells which pattern it was. check is
+            ignored for a stopped process.
+        */
+        StopOnMatch stop;
+        /** Only for subprocess::run(). DigestKind flags of digests to compute
+            over cout as it is read, reported in CompletedProcess::cout_digest.
+            No second pass over the output is made.
+
+            cout must be read by run(): PipeOption::pipe, a ChunkCallback or
+            an OutputSink. With PipeOption::devnull the output is read and
+            discarded instead of going to /dev/null.
+        */
+        int         cout_digest = 0;
+        /** Same as cout_digest for cerr. */
+        int         cerr_digest = 0;
+        /** Stages cout goes through before reaching its destination, in
+            order, e.g. a LineFilter instead of piping into grep. Stop
+            patterns see the output before, digests after the stages.
+
+            cout must be read by run() or be a std::ostream or FILE*. With
+            PipeOption::devnull the output is read and discarded.
+        */
+        TransformStages cout_transforms;
+        /** Same as cout_transforms for cerr. */
+        TransformStages cerr_transforms;
     };
     class ProcessBuilder;
     /** Active running process.
@@ -96,6 +172,24 @@ namespace subprocess {
         */
         PipeHandle  cerr      = kBadPipeValue;
 
+        /** If set, subprocess::run() delivers what is read from cout to this
+            sink instead of capturing it in CompletedProcess::cout.
+        */
+        std::shared_ptr<OutputSink> cout_sink;
+        /** If set, subprocess::run() delivers what is read from cerr to this
+            sink instead of capturing it in CompletedProcess::cerr.
+        */
+        std::shared_ptr<OutputSink> cerr_sink;
+        /** Patterns for subprocess::run() to stop the process on. */
+        StopOnMatch stop;
+        /** DigestKind flags for subprocess::run() to digest cout with. */
+        int         cout_digest = 0;
+        /** DigestKind flags for subprocess::run() to digest cerr with. */
+        int         cerr_digest = 0;
+        /** Stages for subprocess::run() to pass cout through. */
+        TransformStages cout_transforms;
+        /** Stages for subprocess::run() to pass cerr through. */
+        TransformStages cerr_transforms;
 
         pid_t       pid         = 0;
         /** The exit value of the process. Valid once process is completed */
@@ -103,7 +197,11 @@ namespace subprocess {
         std::string cwd;
         CommandLine args;
 
-        /** calls pipe_ignore_and_close on cout */
+        /** calls pipe_ignore_and_close on cout.
+
+            If you know up front the output is not wanted use
+            PipeOption::devnull instead, it needs no thread.
+        */
         void ignore_cout() { pipe_ignore_and_close(cout); cout = kBadPipeValue; }
         /** calls pipe_ignore_and_close on cerr */
         void ignore_cerr() { pipe_ignore_and_close(cerr); cerr = kBadPipeValue; }
@@ -155,6 +253,9 @@ namespace subprocess {
         void close_cin() {
             if (cin != kBadPipeValue) {
 				if (!cin_is_autoclosed) {
+                    // cout may share the socket, it must see the end now
+                    if (cin_is_socket)
+                        socket_shutdown_write(cin);
 					pipe_close(cin);
 				}
                 cin = kBadPipeValue;
@@ -168,6 +269,9 @@ namespace subprocess {
         PROCESS_INFORMATION process_info;
 #endif
 		bool cin_is_autoclosed = false;
+        bool cin_is_socket = false;
+        /** Keeps a PinnedBuffer used as cin alive until the process is waited for */
+        PinnedBuffer cin_buffer;
     };
 
 
@@ -190,9 +294,20 @@ namespace subprocess {
         PipeOption cout_option    = PipeOption::inherit;
         PipeOption cerr_option    = PipeOption::inherit;
 
+        /** Files to open in the child when the option is PipeOption::path */
+        FileRedirect cin_file;
+        FileRedirect cout_file;
+        FileRedirect cerr_file;
+
         bool new_process_group            = false;
         /** If empty inherits from current process */
         EnvMap      env;
+        /** see RunOptions::pass_fds */
+        FdMap       pass_fds;
+        /** see RunOptions::socket_send_buffer */
+        int         socket_send_buffer      = 0;
+        /** see RunOptions::socket_receive_buffer */
+        int         socket_receive_buffer   = 0;
         std::string cwd;
         CommandLine command;
 
@@ -238,6 +353,22 @@ namespace subprocess {
         @return CompletedProcess containing details about execution.
     */
     CompletedProcess run(CommandLine command, RunOptions options={});
+    /** Run a command appending its output to caller owned buffers.
+
+        Same as subprocess::run(CommandLine, RunOptions) but cout and cerr
+        are captured into the given strings through an AppendCapture. Reusing
+        the same strings for repeated runs avoids allocating for every run.
+        The CompletedProcess and exceptions don't carry a copy of the output.
+
+        @param command  The command to run. First element must be executable.
+        @param cout     Output is appended to this.
+        @param cerr     Error output is appended to this, can be the same
+                        string as cout.
+        @param options  Options specifying how to run the command. The cout &
+                        cerr options are replaced.
+    */
+    CompletedProcess run(CommandLine command, std::string& cout,
+        std::string& cerr, RunOptions options={});
 
     /** Helper class to construct RunOptions with minimal typing. */
     struct RunBuilder {
@@ -251,16 +382,33 @@ namespace subprocess {
         RunBuilder(std::initializer_list<std::string> command) : command(command){}
         /** Only for run(), throws exception if command returns non-zero exit code */
         RunBuilder& check(bool ch) {options.check = ch; return *this;}
-        /** Set the cin option. Could be PipeOption, input handle, std::string with data to pass. */
+        /** Set the cin option. Could be PipeOption, input handle, std::string
+            or PinnedBuffer with data to pass, a Broadcast or an
+            InputGenerator.
+        */
         RunBuilder& cin(const PipeVar& cin) {options.cin = cin; return *this;}
-        /** Sets the cout option. Could be a PipeOption, output handle */
+        /** Sets the cout option. Could be a PipeOption, output handle,
+            FileRedirect, ChunkCallback, OutputSink or MemoryCapture.
+        */
         RunBuilder& cout(const PipeVar& cout) {options.cout = cout; return *this;}
-        /** Sets the cerr option. Could be a PipeOption, output handle */
+        /** Sets the cerr option. Could be a PipeOption, output handle,
+            FileRedirect, ChunkCallback, OutputSink or MemoryCapture.
+        */
         RunBuilder& cerr(const PipeVar& cerr) {options.cerr = cerr; return *this;}
         /** Sets the current working directory to use for subprocess */
         RunBuilder& cwd(std::string cwd) {options.cwd = cwd; return *this;}
         /** Sets the environment to use. Default is current environment if unset */
         RunBuilder& env(const EnvMap& env) {options.env = env; return *this;}
+        /** SO_SNDBUF & SO_RCVBUF for the parent's end of socketpair channels */
+        RunBuilder& socket_buffers(int send, int receive) {
+            options.socket_send_buffer = send;
+            options.socket_receive_buffer = receive;
+            return *this;
+        }
+        /** Makes handle available as fd child_fd in the child, see
+            RunOptions::pass_fds.
+        */
+        RunBuilder& pass_fd(int child_fd, PipeHandle handle) {options.pass_fds[child_fd] = handle; return *this;}
         /** Timeout to use for run() invocation only. */
         RunBuilder& timeout(double timeout) {options.timeout = timeout; return *this;}
         /** Set to true to run as new process group. On windows the new process
@@ -270,6 +418,30 @@ namespace subprocess {
             new process and giving process id back to parent process for use.
          */
         RunBuilder& new_process_group(bool new_group) {options.new_process_group = new_group; return *this;}
+        /** Only for run(), stop the process once any pattern is printed. */
+        RunBuilder& stop_on(std::vector<std::string> patterns) {options.stop.patterns = std::move(patterns); return *this;}
+        /** Signals to stop with, sent grace seconds apart. */
+        RunBuilder& stop_signals(std::vector<int> signals, double grace=1.0) {
+            options.stop.signals = std::move(signals);
+            options.stop.grace = grace;
+            return *this;
+        }
+        /** Only for run(), DigestKind flags to digest cout & cerr with. */
+        RunBuilder& digest(int cout_kinds, int cerr_kinds=0) {
+            options.cout_digest = cout_kinds;
+            options.cerr_digest = cerr_kinds;
+            return *this;
+        }
+        /** Adds a stage for cout to go through, after those added before. */
+        RunBuilder& cout_transform(std::shared_ptr<TransformStage> stage) {
+            options.cout_transforms.push_back(std::move(stage));
+            return *this;
+        }
+        /** Adds a stage for cerr to go through, after those added before. */
+        RunBuilder& cerr_transform(std::shared_ptr<TransformStage> stage) {
+            options.cerr_transforms.push_back(std::move(stage));
+            return *this;
+        }
         operator RunOptions() const {return options;}
 
         /** Runs the command already configured.
@@ -2,8 +2,12 @@
 #include "ProcessBuilder.hpp"
 
 #include <spawn.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <set>
 #include <errno.h>
 
 #include "environ.hpp"
@@ -53,6 +57,16 @@ namespace {
         std::vector<char*> m_list;
     };
 
+    int open_flags(subprocess::FileMode mode) {
+        using subprocess::FileMode;
+        switch (mode) {
+        case FileMode::read:        return O_RDONLY;
+        case FileMode::write:       return O_WRONLY | O_CREAT;
+        case FileMode::append:      return O_WRONLY | O_CREAT | O_APPEND;
+        case FileMode::truncate:    return O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        return O_RDONLY;
+    }
 }
 
 
@@ -71,13 +85,68 @@ namespace subprocess {
             int result = posix_spawn_file_actions_adddup2(&actions, fd, newfd);
             throw_os_error("posix_spawn_file_actions_adddup2", result);
         }
+        /*  Gives the child fd as newfd. The dup2() copy is inheritable while
+            fd stays close on exec, so a spawn from another thread meanwhile
+            doesn't inherit it.
+        */
+        void addinherit(int fd, int newfd) {
+            if (fd == newfd) {
+                // dup2() onto itself keeps close on exec
+                pipe_set_inheritable(fd, true);
+                return;
+            }
+            adddup2(fd, newfd);
+            addclose(fd);
+        }
         void addclose(int fd) {
             int result = posix_spawn_file_actions_addclose(&actions, fd);
             throw_os_error("posix_spawn_file_actions_addclose", result);
+            closed.insert(fd);
+        }
+        /*  Closes fd in the child if it would be inherited. Closing one
+            that is already closed fails the spawn with EBADF on some
+            systems, e.g. macos.
+        */
+        void addclose_inherited(int fd) {
+            if (closed.count(fd))
+                return;
+            int flags = fcntl(fd, F_GETFD);
+            if (flags != -1 && !(flags & FD_CLOEXEC))
+                addclose(fd);
+        }
+        void addopen(int fd, const char* path, int flags, mode_t mode) {
+            int result = posix_spawn_file_actions_addopen(&actions, fd, path, flags, mode);
+            throw_os_error("posix_spawn_file_actions_addopen", result);
+        }
+
+        void addclosefrom(int fd) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+            int result = posix_spawn_file_actions_addclosefrom_np(&actions, fd);
+            throw_os_error("posix_spawn_file_actions_addclosefrom_np", result);
+#else
+            // enumerate what is open in the parent, the child has the same
+            DIR* dir = opendir("/dev/fd");
+            if (dir == nullptr)
+                throw_os_error("opendir", errno);
+            int dir_fd = dirfd(dir);
+            std::vector<int> fds;
+            while (dirent* entry = readdir(dir)) {
+                if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+                    continue;
+                int open_fd = atoi(entry->d_name);
+                if (open_fd >= fd && open_fd != dir_fd)
+                    fds.push_back(open_fd);
+            }
+            closedir(dir);
+            for (int open_fd : fds)
+                addclose_inherited(open_fd);
+#endif
         }
 
         posix_spawn_file_actions_t* get() {return &actions;}
         posix_spawn_file_actions_t actions;
+        // fds the child closes by now
+        std::set<int> closed;
     };
 
 #ifndef _WIN32
@@ -94,8 +163,17 @@ namespace subprocess {
         PipePair cin_pair;
         PipePair cout_pair;
         PipePair cerr_pair;
+        // input is the parent's end, output the child's
+        PipePair socket_pair;
+        PipePair cerr_socket;
 
         FileActions actions;
+        auto create_socket = [&]() {
+            PipePair pair = socket_create(false);
+            socket_set_buffers(pair.input, socket_send_buffer, socket_receive_buffer);
+            socket_set_buffers(pair.output, socket_receive_buffer, socket_send_buffer);
+            return pair;
+        };
 
         if (cin_option == PipeOption::close)
             actions.addclose(kStdInValue);
@@ -104,25 +182,32 @@ namespace subprocess {
                 throw std::invalid_argument("ProcessBuilder: bad pipe value for cin");
             }
 
-            pipe_set_inheritable(this->cin_pipe, true);
-            actions.adddup2(this->cin_pipe, kStdInValue);
-            actions.addclose(this->cin_pipe);
+            actions.addinherit(this->cin_pipe, kStdInValue);
         } else if (cin_option == PipeOption::pipe) {
-            cin_pair = pipe_create();
+            // close on exec from the start, only the dup2() copy is inherited
+            cin_pair = pipe_create(false);
             actions.addclose(cin_pair.output);
-            actions.adddup2(cin_pair.input, kStdInValue);
-            actions.addclose(cin_pair.input);
+            actions.addinherit(cin_pair.input, kStdInValue);
             process.cin = cin_pair.output;
+        } else if (cin_option == PipeOption::socketpair) {
+            socket_pair = create_socket();
+            actions.addclose(socket_pair.input);
+            actions.adddup2(socket_pair.output, kStdInValue);
+            process.cin = socket_pair.input;
+            process.cin_is_socket = true;
+        } else if (cin_option == PipeOption::devnull) {
+            actions.addopen(kStdInValue, "/dev/null", O_RDONLY, 0);
+        } else if (cin_option == PipeOption::path) {
+            actions.addopen(kStdInValue, cin_file.path.c_str(), open_flags(cin_file.mode), 0666);
         }
 
 
         if (cout_option == PipeOption::close)
             actions.addclose(kStdOutValue);
         else if (cout_option == PipeOption::pipe) {
-            cout_pair = pipe_create();
+            cout_pair = pipe_create(false);
             actions.addclose(cout_pair.input);
-            actions.adddup2(cout_pair.output, kStdOutValue);
-            actions.addclose(cout_pair.output);
+            actions.addinherit(cout_pair.output, kStdOutValue);
             process.cout = cout_pair.input;
         } else if (cout_option == PipeOption::cerr) {
             // we have to wait until stderr is setup first
@@ -130,18 +215,31 @@ namespace subprocess {
             if (this->cout_pipe == kBadPipeValue) {
                 throw std::invalid_argument("ProcessBuilder: bad pipe value for cout");
             }
-            pipe_set_inheritable(this->cout_pipe, true);
-            actions.adddup2(this->cout_pipe, kStdOutValue);
-            actions.addclose(this->cout_pipe);
+            actions.addinherit(this->cout_pipe, kStdOutValue);
+        } else if (cout_option == PipeOption::socketpair) {
+            if (socket_pair) {
+                // one socket both ways, the parent reads from a duplicate
+                process.cout = fcntl(socket_pair.input, F_DUPFD_CLOEXEC, 0);
+                if (process.cout < 0)
+                    throw_os_error("fcntl", errno);
+            } else {
+                socket_pair = create_socket();
+                actions.addclose(socket_pair.input);
+                process.cout = socket_pair.input;
+            }
+            actions.adddup2(socket_pair.output, kStdOutValue);
+        } else if (cout_option == PipeOption::devnull) {
+            actions.addopen(kStdOutValue, "/dev/null", O_WRONLY, 0);
+        } else if (cout_option == PipeOption::path) {
+            actions.addopen(kStdOutValue, cout_file.path.c_str(), open_flags(cout_file.mode), 0666);
         }
 
         if (cerr_option == PipeOption::close)
             actions.addclose(kStdErrValue);
         else if (cerr_option == PipeOption::pipe) {
-            cerr_pair = pipe_create();
+            cerr_pair = pipe_create(false);
             actions.addclose(cerr_pair.input);
-            actions.adddup2(cerr_pair.output, kStdErrValue);
-            actions.addclose(cerr_pair.output);
+            actions.addinherit(cerr_pair.output, kStdErrValue);
             process.cerr = cerr_pair.input;
         } else if (cerr_option == PipeOption::cout) {
             actions.adddup2(kStdOutValue, kStdErrValue);
@@ -150,14 +248,58 @@ namespace subprocess {
                 throw std::invalid_argument("ProcessBuilder: bad pipe value for cerr");
             }
 
-            pipe_set_inheritable(this->cerr_pipe, true);
-            actions.adddup2(this->cerr_pipe, kStdErrValue);
-            actions.addclose(this->cerr_pipe);
+            actions.addinherit(this->cerr_pipe, kStdErrValue);
+        } else if (cerr_option == PipeOption::socketpair) {
+            cerr_socket = create_socket();
+            actions.addclose(cerr_socket.input);
+            actions.adddup2(cerr_socket.output, kStdErrValue);
+            actions.addclose(cerr_socket.output);
+            process.cerr = cerr_socket.input;
+        } else if (cerr_option == PipeOption::devnull) {
+            actions.addopen(kStdErrValue, "/dev/null", O_WRONLY, 0);
+        } else if (cerr_option == PipeOption::path) {
+            actions.addopen(kStdErrValue, cerr_file.path.c_str(), open_flags(cerr_file.mode), 0666);
         }
 
         if (cout_option == PipeOption::cerr) {
             actions.adddup2(kStdErrValue, kStdOutValue);
         }
+        if (socket_pair)
+            actions.addclose(socket_pair.output);
+
+        /*  The handles are copied above all targets first, so a handle that
+            is also the target of another can't be overwritten before it's
+            used. The copies are close on exec, dup2() to the target clears
+            that even when the handle already has the target's number.
+        */
+        std::vector<int> pass_copies;
+        struct CloseCopies {
+            ~CloseCopies() {
+                for (int fd : fds)
+                    ::close(fd);
+            }
+            std::vector<int>& fds;
+        } close_copies{pass_copies};
+        if (!pass_fds.empty()) {
+            int last = pass_fds.rbegin()->first;
+            for (auto& pass : pass_fds) {
+                if (pass.first <= kStdErrValue)
+                    throw std::invalid_argument("ProcessBuilder: pass_fds target must be above 2");
+                if (pass.second == kBadPipeValue)
+                    throw std::invalid_argument("ProcessBuilder: bad pipe value in pass_fds");
+                int copy = fcntl(pass.second, F_DUPFD_CLOEXEC, last + 1);
+                if (copy < 0)
+                    throw_os_error("fcntl", errno);
+                pass_copies.push_back(copy);
+                actions.adddup2(copy, pass.first);
+            }
+            // nothing else is inherited
+            for (int fd = kStdErrValue + 1; fd < last; ++fd) {
+                if (pass_fds.count(fd) == 0)
+                    actions.addclose_inherited(fd);
+            }
+            actions.addclosefrom(last + 1);
+        }
         pid_t pid;
         cstring_vector args;
         args.reserve(command.size()+1);
@@ -229,9 +371,13 @@ namespace subprocess {
             cout_pair.close_output();
         if (cerr_pair)
             cerr_pair.close_output();
+        socket_pair.close_output();
+        cerr_socket.close_output();
         cin_pair.disown();
         cout_pair.disown();
         cerr_pair.disown();
+        socket_pair.disown();
+        cerr_socket.disown();
         process.pid = pid;
         process.args = command;
         return process;
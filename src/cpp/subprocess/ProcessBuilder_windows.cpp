@@ -25,9 +25,39 @@ bool disable_inherit(subprocess::PipeHandle handle) {
     return !!SetHandleInformation(handle, HANDLE_FLAG_INHERIT, 0);
 }
 
+/*  Windows has no way for the child to open its own redirects, so the file is
+    opened inheritable here and closed again once the child has it.
+*/
+static HANDLE open_redirect(const std::string& path, subprocess::FileMode mode,
+    SECURITY_ATTRIBUTES* security) {
+    using subprocess::FileMode;
+    DWORD access        = GENERIC_WRITE;
+    DWORD disposition   = OPEN_ALWAYS;
+    switch (mode) {
+    case FileMode::read:
+        access      = GENERIC_READ;
+        disposition = OPEN_EXISTING;
+        break;
+    case FileMode::write:       break;
+    case FileMode::append:      access = FILE_APPEND_DATA; break;
+    case FileMode::truncate:    disposition = CREATE_ALWAYS; break;
+    }
+    HANDLE handle = CreateFileW((LPCWSTR)subprocess::utf8_to_utf16(path).c_str(),
+        access, FILE_SHARE_READ | FILE_SHARE_WRITE, security, disposition,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw subprocess::OSError("could not open " + path + " for redirect");
+    return handle;
+}
+
 namespace subprocess {
 
     Popen ProcessBuilder::run_command(const CommandLine& command) {
+        if (!pass_fds.empty())
+            throw std::domain_error("pass_fds is not supported on windows");
+        if (cin_option == PipeOption::socketpair || cout_option == PipeOption::socketpair
+            || cerr_option == PipeOption::socketpair)
+            throw std::domain_error("PipeOption::socketpair is not supported on windows");
         std::string program = find_program(command[0]);
         if(program.empty()) {
             throw CommandNotFoundError("command not found " + command[0]);
@@ -39,6 +69,14 @@ namespace subprocess {
         PipePair cout_pair;
         PipePair cerr_pair;
         PipePair closed_pair;
+        std::vector<HANDLE> opened_files;
+        struct CloseOpenedFiles {
+            std::vector<HANDLE>& files;
+            ~CloseOpenedFiles() {
+                for (HANDLE file : files)
+                    CloseHandle(file);
+            }
+        } close_opened_files{opened_files};
 
         SECURITY_ATTRIBUTES saAttr = {0};
 
@@ -73,6 +111,12 @@ namespace subprocess {
             siStartInfo.hStdInput = cin_pair.input;
             process.cin = cin_pair.output;
             disable_inherit(cin_pair.output);
+        } else if (cin_option == PipeOption::devnull) {
+            opened_files.push_back(open_redirect("NUL", FileMode::read, &saAttr));
+            siStartInfo.hStdInput = opened_files.back();
+        } else if (cin_option == PipeOption::path) {
+            opened_files.push_back(open_redirect(cin_file.path, cin_file.mode, &saAttr));
+            siStartInfo.hStdInput = opened_files.back();
         }
 
         if (cout_option == PipeOption::close) {
@@ -89,6 +133,12 @@ namespace subprocess {
         } else if (cout_option == PipeOption::specific) {
             pipe_set_inheritable(cout_pipe, true);
             siStartInfo.hStdOutput = cout_pipe;
+        } else if (cout_option == PipeOption::devnull) {
+            opened_files.push_back(open_redirect("NUL", FileMode::write, &saAttr));
+            siStartInfo.hStdOutput = opened_files.back();
+        } else if (cout_option == PipeOption::path) {
+            opened_files.push_back(open_redirect(cout_file.path, cout_file.mode, &saAttr));
+            siStartInfo.hStdOutput = opened_files.back();
         }
 
         if (cerr_option == PipeOption::close) {
@@ -105,6 +155,12 @@ namespace subprocess {
         } else if (cerr_option == PipeOption::specific) {
             pipe_set_inheritable(cerr_pipe, true);
             siStartInfo.hStdError = cerr_pipe;
+        } else if (cerr_option == PipeOption::devnull) {
+            opened_files.push_back(open_redirect("NUL", FileMode::write, &saAttr));
+            siStartInfo.hStdError = opened_files.back();
+        } else if (cerr_option == PipeOption::path) {
+            opened_files.push_back(open_redirect(cerr_file.path, cerr_file.mode, &saAttr));
+            siStartInfo.hStdError = opened_files.back();
         }
 
         // I don't know why someone would want to do this. But for completeness
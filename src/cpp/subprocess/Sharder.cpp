@@ -0,0 +1,365 @@
+#include "Sharder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "pipe.hpp"
+#include "SigPipeGuard.hpp"
+#include "simd.hpp"
+
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#include <cerrno>
+#endif
+
+using subprocess::details::find_byte;
+using subprocess::details::SigPipeGuard;
+
+namespace {
+    std::size_t count_records(const char* pos, const char* end, char delimiter) {
+        std::size_t count = 0;
+        while (true) {
+            pos = find_byte(pos, end, delimiter);
+            if (pos == end)
+                return count;
+            ++count;
+            ++pos;
+        }
+    }
+}
+
+namespace subprocess {
+    struct Sharder::Worker {
+        Popen                   popen;
+        std::thread             reader;
+        std::mutex              mutex;
+        std::condition_variable ready;
+        // ordered mode: output not merged yet, from offset start
+        std::string             buffer;
+        std::size_t             start   = 0;
+        std::size_t             records = 0;
+        bool                    done    = false;
+    };
+
+    Sharder::Sharder(CommandLine command, ShardOptions options)
+    : mCommand(std::move(command)), mOptions(std::move(options)) {
+        if (mOptions.batch_size == 0)
+            mOptions.batch_size = 1;
+        int count = mOptions.workers;
+        if (count <= 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        auto cerr_option = std::get_if<PipeOption>(&mOptions.run.cerr);
+        if (cerr_option && (*cerr_option == PipeOption::pipe
+            || *cerr_option == PipeOption::socketpair))
+            throw std::domain_error("Sharder: cerr of the workers can't be a pipe");
+
+        RunOptions run_options = mOptions.run;
+        run_options.cin  = PipeOption::pipe;
+        run_options.cout = PipeOption::pipe;
+        try {
+            for (int i = 0; i < count; ++i) {
+                auto worker = std::make_unique<Worker>();
+                worker->popen = Popen(mCommand, run_options);
+                mWorkers.push_back(std::move(worker));
+            }
+        } catch (...) {
+            for (auto& worker : mWorkers)
+                worker->popen.close();
+            throw;
+        }
+        for (auto& worker : mWorkers) {
+            Worker* pointer = worker.get();
+            worker->reader = std::thread([this, pointer]() { read_worker(*pointer); });
+        }
+        if (mOptions.ordered)
+            mMerger = std::thread([this]() { merge_ordered(); });
+    }
+
+    Sharder::~Sharder() {
+        if (!mFinished) {
+            try {
+                finish();
+            } catch (...) {
+            }
+        }
+    }
+
+    void Sharder::write(std::string_view data) {
+        if (mFinished)
+            throw std::runtime_error("Sharder: write after finish");
+        const std::size_t batch = mOptions.batch_size;
+        const char delimiter = mOptions.delimiter;
+        if (!mPending.empty()) {
+            // complete the pending batch first
+            std::size_t wanted = mPending.size() < batch? batch - mPending.size() : 0;
+            if (wanted >= data.size()) {
+                mPending.append(data);
+                return;
+            }
+            const char* end = data.data() + data.size();
+            const char* cut = find_byte(data.data() + wanted, end, delimiter);
+            if (cut == end) {
+                mPending.append(data);
+                return;
+            }
+            std::size_t size = cut + 1 - data.data();
+            mPending.append(data.data(), size);
+            dispatch(mPending);
+            mPending.clear();
+            data.remove_prefix(size);
+        }
+        // straight from the callers memory, only a trailing part is copied
+        while (data.size() > batch) {
+            const char* end = data.data() + data.size();
+            const char* cut = find_byte(data.data() + batch, end, delimiter);
+            if (cut == end)
+                break;
+            std::size_t size = cut + 1 - data.data();
+            dispatch(data.substr(0, size));
+            data.remove_prefix(size);
+        }
+        mPending.append(data.data(), data.size());
+    }
+
+    void Sharder::dispatch(std::string_view batch) {
+        std::size_t index = pick_worker();
+        if (index >= mWorkers.size())
+            return; // every worker is gone
+        Worker& worker = *mWorkers[index];
+        if (mOptions.ordered) {
+            std::size_t records = count_records(batch.data(),
+                batch.data() + batch.size(), mOptions.delimiter);
+            if (!batch.empty() && batch.back() != mOptions.delimiter)
+                ++records;
+            std::unique_lock<std::mutex> lock(mMutex);
+            mBatches.emplace_back(index, records);
+            mBatchReady.notify_one();
+        }
+
+        SigPipeGuard guard;
+        if (pipe_write_all(worker.popen.cin, batch.data(), batch.size()) < batch.size()) {
+            // the worker is gone, skip it from now on
+            pipe_close(worker.popen.cin);
+            worker.popen.cin = kBadPipeValue;
+        }
+    }
+
+    std::size_t Sharder::pick_worker() {
+        const std::size_t count = mWorkers.size();
+#ifndef _WIN32
+        if (mOptions.order == ShardOrder::least_loaded) {
+            std::vector<PipePoll> entries;
+            std::vector<std::size_t> indices;
+            for (std::size_t i = 0; i < count; ++i) {
+                std::size_t index = (mNext + i) % count;
+                if (mWorkers[index]->popen.cin == kBadPipeValue)
+                    continue;
+                entries.push_back({mWorkers[index]->popen.cin, kPipeWritable});
+                indices.push_back(index);
+            }
+            if (entries.empty())
+                return count;
+            pipe_poll(&entries[0], entries.size());
+            std::size_t best = count;
+            int best_queued = 0;
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].ready == 0)
+                    continue;
+                int queued = 0;
+#ifdef FIONREAD
+                // bytes the worker hasn't read yet, works on the write end
+                if (ioctl(entries[i].handle, FIONREAD, &queued) < 0)
+                    queued = 0;
+#endif
+                if (best == count || queued < best_queued) {
+                    best = indices[i];
+                    best_queued = queued;
+                }
+            }
+            mNext = (best + 1) % count;
+            return best;
+        }
+#endif
+        for (std::size_t i = 0; i < count; ++i) {
+            std::size_t index = (mNext + i) % count;
+            if (mWorkers[index]->popen.cin != kBadPipeValue) {
+                mNext = (index + 1) % count;
+                return index;
+            }
+        }
+        return count;
+    }
+
+    void Sharder::emit(std::string_view output) {
+        if (output.empty())
+            return;
+        if (mOptions.cout)
+            mOptions.cout->write(output);
+        else
+            mOutput.append(output);
+    }
+
+    void Sharder::read_worker(Worker& worker) {
+        const char delimiter = mOptions.delimiter;
+        std::vector<char> buffer(64*1024);
+        std::string partial;
+        try {
+            while (true) {
+                ssize_t transfered = pipe_read(worker.popen.cout, &buffer[0], buffer.size());
+                if (transfered <= 0)
+                    break;
+                const char* begin = &buffer[0];
+                const char* end = begin + transfered;
+                if (mOptions.ordered) {
+                    std::size_t records = count_records(begin, end, delimiter);
+                    std::unique_lock<std::mutex> lock(worker.mutex);
+                    worker.buffer.append(begin, end);
+                    worker.records += records;
+                    if (records > 0)
+                        worker.ready.notify_one();
+                    continue;
+                }
+                // only whole records go out so workers don't interleave
+                const char* last = end;
+                while (last > begin && last[-1] != delimiter)
+                    --last;
+                if (last == begin) {
+                    partial.append(begin, end);
+                    continue;
+                }
+                {
+                    std::unique_lock<std::mutex> lock(mOutputMutex);
+                    if (!mError) {
+                        emit(partial);
+                        emit(std::string_view(begin, last - begin));
+                    }
+                }
+                partial.assign(last, end);
+            }
+            if (!mOptions.ordered && !partial.empty()) {
+                std::unique_lock<std::mutex> lock(mOutputMutex);
+                if (!mError)
+                    emit(partial);
+            }
+        } catch (...) {
+            {
+                std::unique_lock<std::mutex> lock(mOutputMutex);
+                if (!mError)
+                    mError = std::current_exception();
+            }
+            // keep draining so the worker can't block on a full pipe
+            pipe_ignore_and_close(worker.popen.cout);
+            worker.popen.cout = kBadPipeValue;
+        }
+        pipe_close(worker.popen.cout);
+        worker.popen.cout = kBadPipeValue;
+
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        if (worker.buffer.size() > worker.start && worker.buffer.back() != delimiter)
+            ++worker.records;
+        worker.done = true;
+        worker.ready.notify_one();
+    }
+
+    void Sharder::merge_ordered() {
+        const char delimiter = mOptions.delimiter;
+        while (true) {
+            std::pair<std::size_t, std::size_t> batch;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mBatchReady.wait(lock, [this]() { return !mBatches.empty() || mInputDone; });
+                if (mBatches.empty())
+                    return;
+                batch = mBatches.front();
+                mBatches.pop_front();
+            }
+            Worker& worker = *mWorkers[batch.first];
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.ready.wait(lock, [&]() {
+                return worker.records >= batch.second || worker.done;
+            });
+            // a worker that died leaves its batches short
+            std::size_t records = std::min(batch.second, worker.records);
+            const char* begin = worker.buffer.data() + worker.start;
+            const char* end = worker.buffer.data() + worker.buffer.size();
+            const char* pos = begin;
+            for (std::size_t i = 0; i < records && pos < end; ++i) {
+                const char* found = find_byte(pos, end, delimiter);
+                pos = found == end? end : found + 1;
+            }
+            try {
+                std::unique_lock<std::mutex> output_lock(mOutputMutex);
+                if (!mError)
+                    emit(std::string_view(begin, pos - begin));
+            } catch (...) {
+                std::unique_lock<std::mutex> output_lock(mOutputMutex);
+                mError = std::current_exception();
+            }
+            worker.records -= records;
+            worker.start += pos - begin;
+            if (worker.start == worker.buffer.size()) {
+                worker.buffer.clear();
+                worker.start = 0;
+            } else if (worker.start > 1024*1024 && worker.start > worker.buffer.size()/2) {
+                worker.buffer.erase(0, worker.start);
+                worker.start = 0;
+            }
+        }
+    }
+
+    CompletedProcess Sharder::finish() {
+        if (mFinished)
+            throw std::runtime_error("Sharder: already finished");
+        mFinished = true;
+        if (!mPending.empty())
+            dispatch(mPending);
+        mPending.clear();
+
+        for (auto& worker : mWorkers) {
+            pipe_close(worker->popen.cin);
+            worker->popen.cin = kBadPipeValue;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mInputDone = true;
+            mBatchReady.notify_one();
+        }
+        for (auto& worker : mWorkers)
+            worker->reader.join();
+        if (mMerger.joinable())
+            mMerger.join();
+
+        CompletedProcess completed;
+        completed.args = mCommand;
+        completed.returncode = 0;
+        for (auto& worker : mWorkers) {
+            worker->popen.wait();
+            if (completed.returncode == 0)
+                completed.returncode = worker->popen.returncode;
+        }
+        if (mError)
+            std::rethrow_exception(mError);
+        if (mOptions.cout) {
+            mOptions.cout->finish();
+            mOptions.cout->collect(completed.cout, completed.cout_dropped);
+        } else {
+            completed.cout = std::move(mOutput);
+        }
+        if (mOptions.run.check && completed.returncode != 0) {
+            CalledProcessError error("failed to execute " + mCommand[0]);
+            error.cmd           = mCommand;
+            error.returncode    = completed.returncode;
+            error.cout          = std::move(completed.cout);
+            error.cout_dropped  = completed.cout_dropped;
+            throw error;
+        }
+        return completed;
+    }
+
+    CompletedProcess run_sharded(CommandLine command, std::string_view input,
+        ShardOptions options) {
+        Sharder sharder(std::move(command), std::move(options));
+        sharder.write(input);
+        return sharder.finish();
+    }
+}
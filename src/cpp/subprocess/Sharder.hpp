@@ -0,0 +1,131 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ProcessBuilder.hpp"
+
+namespace subprocess {
+    /** How Sharder picks the worker for the next batch of records. */
+    enum class ShardOrder {
+        round_robin,    ///< Workers take turns.
+        /** The worker with the least input still waiting in its pipe. Only
+            differs from round_robin on linux, where the pipe fill level can
+            be queried. Elsewhere it takes the first worker with room.
+        */
+        least_loaded
+    };
+
+    struct ShardOptions {
+        /** Number of copies of the command to run, 0 for one per cpu. */
+        int             workers     = 0;
+        ShardOrder      order       = ShardOrder::round_robin;
+        /** Emit the output in input order. The command must output exactly
+            one record per input record, as a transform does. Batches are
+            tagged with their sequence and worker and the output is
+            reassembled accordingly.
+
+            When false records are emitted as soon as they arrive, whole
+            records from different workers are never interleaved.
+        */
+        bool            ordered     = false;
+        /** Records are grouped into batches of about this many bytes. A
+            record is never split.
+        */
+        std::size_t     batch_size  = 64*1024;
+        char            delimiter   = '\n';
+        /** If set receives the merged output instead of it being captured
+            in CompletedProcess::cout. Called from internal threads, never
+            concurrently.
+        */
+        std::shared_ptr<OutputSink> cout;
+        /** Options for each worker, e.g. env, cwd & check. cin & cout are
+            used by the sharder. cerr must not be a pipe as nothing would
+            read it.
+        */
+        RunOptions      run;
+    };
+
+    /** Spreads newline (or other delimiter) separated records across
+        several copies of the same command and gathers their output.
+
+        e.g.
+        @code
+            Sharder sharder({"grep", "needle"}, ShardOptions{8});
+            while (read_more(chunk))
+                sharder.write(chunk);
+            CompletedProcess result = sharder.finish();
+        @endcode
+
+        write() takes arbitrary chunks, records are reassembled and batches
+        are written to the workers from the calling thread. It blocks when
+        the workers can't keep up. A worker that exits early is skipped
+        from then on, records it didn't read are lost.
+    */
+    class Sharder {
+    public:
+        /** Starts the workers.
+
+            @throw std::domain_error if options.run.cerr is a pipe.
+        */
+        Sharder(CommandLine command, ShardOptions options={});
+        /** Calls finish() if not done yet, ignoring errors. */
+        ~Sharder();
+        Sharder(const Sharder&)=delete;
+        Sharder& operator=(const Sharder&)=delete;
+
+        /** Feeds more input. Records can span calls. */
+        void write(std::string_view data);
+        /** Sends the remaining input, a last record without a delimiter
+            included, and waits for the workers.
+
+            @return returncode is the first non zero exit code of a worker,
+                    or 0. cout is the merged output unless a sink was given.
+            @throw CalledProcessError if options.run.check and a worker failed.
+            @throw whatever the output sink threw.
+        */
+        CompletedProcess finish();
+
+        /** @return number of workers running. */
+        std::size_t workers() const { return mWorkers.size(); }
+    private:
+        struct Worker;
+        void dispatch(std::string_view batch);
+        std::size_t pick_worker();
+        void read_worker(Worker& worker);
+        void merge_ordered();
+        void emit(std::string_view output);
+
+        CommandLine                             mCommand;
+        ShardOptions                            mOptions;
+        std::vector<std::unique_ptr<Worker>>    mWorkers;
+        std::string                             mPending;
+        std::size_t                             mNext = 0;
+
+        std::mutex                              mMutex;
+        std::condition_variable                 mBatchReady;
+        // worker & record count of each dispatched batch, in input order
+        std::deque<std::pair<std::size_t, std::size_t>> mBatches;
+        bool                                    mInputDone = false;
+        std::thread                             mMerger;
+
+        std::mutex                              mOutputMutex;
+        std::string                             mOutput;
+        std::exception_ptr                      mError;
+        bool                                    mFinished = false;
+    };
+
+    /** Runs command sharded over several workers with all of input.
+
+        see Sharder for details.
+    */
+    CompletedProcess run_sharded(CommandLine command, std::string_view input,
+        ShardOptions options={});
+}
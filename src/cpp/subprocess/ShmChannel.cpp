@@ -0,0 +1,100 @@
+#include "ShmChannel.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <new>
+
+namespace subprocess {
+#ifdef __linux__
+    namespace {
+        PipeHandle duplicate(PipeHandle handle) {
+            PipeHandle copy = fcntl(handle, F_DUPFD_CLOEXEC, 0);
+            if (copy < 0)
+                details::throw_os_error("fcntl", errno);
+            return copy;
+        }
+    }
+
+    ShmChannel::ShmChannel(std::size_t capacity) {
+        std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+        mCapacity = page;
+        while (mCapacity < capacity)
+            mCapacity *= 2;
+        // the header gets a page of its own so the data can be mapped
+        std::size_t data_offset = page;
+        while (data_offset < sizeof(shm::RingHeader))
+            data_offset += page;
+
+        try {
+            mMemory = memfd_create("subprocess-ring", MFD_CLOEXEC);
+            if (mMemory < 0)
+                details::throw_os_error("memfd_create", errno);
+            if (ftruncate(mMemory, (off_t)(data_offset + mCapacity)) != 0)
+                details::throw_os_error("ftruncate", errno);
+            void* memory = mmap(nullptr, sizeof(shm::RingHeader), PROT_READ | PROT_WRITE,
+                MAP_SHARED, mMemory, 0);
+            if (memory == MAP_FAILED)
+                details::throw_os_error("mmap", errno);
+            auto header = new (memory) shm::RingHeader{};
+            header->magic = shm::kRingMagic;
+            header->version = shm::kRingVersion;
+            header->capacity = mCapacity;
+            header->data_offset = data_offset;
+            munmap(memory, sizeof(shm::RingHeader));
+
+            mDataEvent = eventfd(0, EFD_CLOEXEC);
+            if (mDataEvent < 0)
+                details::throw_os_error("eventfd", errno);
+            mSpaceEvent = eventfd(0, EFD_CLOEXEC);
+            if (mSpaceEvent < 0)
+                details::throw_os_error("eventfd", errno);
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    ShmChannel::~ShmChannel() {
+        close();
+    }
+
+    void ShmChannel::close() {
+        for (PipeHandle* handle : {&mMemory, &mDataEvent, &mSpaceEvent}) {
+            if (*handle != kBadPipeValue)
+                pipe_close(*handle);
+            *handle = kBadPipeValue;
+        }
+    }
+
+    void ShmChannel::pass_to(RunOptions& options, int base) const {
+        options.pass_fds[base] = mMemory;
+        options.pass_fds[base + 1] = mDataEvent;
+        options.pass_fds[base + 2] = mSpaceEvent;
+    }
+
+    shm::RingWriter ShmChannel::writer() const {
+        return shm::RingWriter(duplicate(mMemory), duplicate(mDataEvent),
+            duplicate(mSpaceEvent));
+    }
+
+    shm::RingReader ShmChannel::reader() const {
+        return shm::RingReader(duplicate(mMemory), duplicate(mDataEvent),
+            duplicate(mSpaceEvent));
+    }
+#else
+    ShmChannel::ShmChannel(std::size_t) {
+        throw std::domain_error("ShmChannel is only supported on linux");
+    }
+    ShmChannel::~ShmChannel() {
+    }
+    void ShmChannel::close() {
+    }
+    void ShmChannel::pass_to(RunOptions&, int) const {
+    }
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ProcessBuilder.hpp"
+#include "ShmRing.hpp"
+
+namespace subprocess {
+    /** A shared memory ring buffer to stream bytes between parent and child.
+
+        Data is copied once into memory shared by both processes instead of
+        through a pipe, and a syscall is only needed to wake up a side that
+        ran out of data or space. The ring is a memfd, wakeups go through
+        two eventfds. The child gets the three of them through pass_fds and
+        uses the header only ShmRing.hpp, it needs nothing else.
+
+        e.g. a child reading from fd 3 and answering on fd 6
+        @code
+            ShmChannel to_child, from_child;
+            RunOptions options;
+            to_child.pass_to(options, 3);
+            from_child.pass_to(options, 6);
+            Popen popen({"worker"}, options);
+            auto writer = to_child.writer();
+            auto reader = from_child.reader();
+
+            // in the child
+            auto reader = subprocess::shm::RingReader::from_fds(3);
+            auto writer = subprocess::shm::RingWriter::from_fds(6);
+        @endcode
+
+        Each ring has exactly one writer and one reader. A side blocked on
+        a peer that died without closing its end waits forever, close the
+        writers when done. linux only.
+    */
+    class ShmChannel {
+    public:
+        /** Creates the ring.
+
+            @param capacity rounded up to a power of two of at least a page.
+
+            @throw OSError if creating the memfd or eventfds fails.
+            @throw std::domain_error if not on linux.
+        */
+        explicit ShmChannel(std::size_t capacity = 1 << 20);
+        ShmChannel(const ShmChannel&)=delete;
+        ShmChannel& operator=(const ShmChannel&)=delete;
+        ~ShmChannel();
+
+        std::size_t capacity() const { return mCapacity; }
+        /** Adds the ring to options.pass_fds as base, base+1 & base+2. */
+        void pass_to(RunOptions& options, int base) const;
+#ifdef __linux__
+        /** The parent's end for writing to the child. */
+        shm::RingWriter writer() const;
+        /** The parent's end for reading from the child. */
+        shm::RingReader reader() const;
+#endif
+    private:
+        void close();
+
+        std::size_t mCapacity   = 0;
+        PipeHandle  mMemory     = kBadPipeValue;
+        PipeHandle  mDataEvent  = kBadPipeValue;
+        PipeHandle  mSpaceEvent = kBadPipeValue;
+    };
+}
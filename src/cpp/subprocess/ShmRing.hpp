@@ -0,0 +1,282 @@
+#pragma once
+/*  Header only, programs using a ShmChannel from the child's side only need
+    this file and no library.
+*/
+
+#ifdef __linux__
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace subprocess {
+    namespace shm {
+        constexpr std::uint32_t kRingMagic      = 0x53524e47;
+        constexpr std::uint32_t kRingVersion    = 1;
+
+        /** Start of the shared memory. The ring data follows at data_offset,
+            a multiple of the page size.
+        */
+        struct RingHeader {
+            std::uint32_t               magic;
+            std::uint32_t               version;
+            std::uint64_t               capacity;
+            std::uint64_t               data_offset;
+            // written by the producer
+            alignas(64) std::atomic<std::uint64_t>  head;
+            std::atomic<std::uint32_t>  producer_waiting;
+            std::atomic<std::uint32_t>  closed;
+            // written by the consumer
+            alignas(64) std::atomic<std::uint64_t>  tail;
+            std::atomic<std::uint32_t>  consumer_waiting;
+        };
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+            "the ring needs lock free atomics to be shared between processes");
+
+        /** One end of a ring, owns the fds it is given.
+
+            The fds are, by convention consecutive from a base in the child:
+            base the memfd, base+1 the eventfd signaling data, base+2 the
+            eventfd signaling space.
+        */
+        class RingEnd {
+        public:
+            RingEnd(){}
+            RingEnd(int memory_fd, int data_event, int space_event)
+            : mDataEvent(data_event), mSpaceEvent(space_event) {
+                map(memory_fd);
+            }
+            RingEnd(const RingEnd&)=delete;
+            RingEnd& operator=(const RingEnd&)=delete;
+            RingEnd(RingEnd&& other) { *this = std::move(other); }
+            RingEnd& operator=(RingEnd&& other) {
+                if (this != &other) {
+                    release();
+                    mHeader = other.mHeader;
+                    mData = other.mData;
+                    mCapacity = other.mCapacity;
+                    mDataEvent = other.mDataEvent;
+                    mSpaceEvent = other.mSpaceEvent;
+                    other.mHeader = nullptr;
+                    other.mData = nullptr;
+                    other.mDataEvent = other.mSpaceEvent = -1;
+                }
+                return *this;
+            }
+            ~RingEnd() { release(); }
+
+            std::size_t capacity() const { return mCapacity; }
+            explicit operator bool() const { return mHeader != nullptr; }
+        protected:
+            static void throw_errno(const char* function) {
+                throw std::system_error(errno, std::generic_category(), function);
+            }
+            /*  The data is mapped twice back to back, so any span of up to
+                capacity bytes starting in the first copy is contiguous.
+            */
+            void map(int memory_fd) {
+                void* header = mmap(nullptr, sizeof(RingHeader), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, memory_fd, 0);
+                if (header == MAP_FAILED) {
+                    int error = errno;
+                    ::close(memory_fd);
+                    release();
+                    errno = error;
+                    throw_errno("mmap");
+                }
+                mHeader = static_cast<RingHeader*>(header);
+                if (mHeader->magic != kRingMagic || mHeader->version != kRingVersion) {
+                    ::close(memory_fd);
+                    release();
+                    throw std::invalid_argument("RingEnd: not a ring");
+                }
+                mCapacity = mHeader->capacity;
+                void* area = mmap(nullptr, 2*mCapacity, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                bool mapped = area != MAP_FAILED;
+                if (mapped) {
+                    mData = static_cast<char*>(area);
+                    for (int copy = 0; copy < 2 && mapped; ++copy) {
+                        mapped = mmap(mData + copy*mCapacity, mCapacity,
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                            memory_fd, (off_t)mHeader->data_offset) != MAP_FAILED;
+                    }
+                }
+                int error = errno;
+                // the mappings keep the memory alive
+                ::close(memory_fd);
+                if (!mapped) {
+                    release();
+                    errno = error;
+                    throw_errno("mmap");
+                }
+            }
+            void release() {
+                if (mData)
+                    munmap(mData, 2*mCapacity);
+                if (mHeader)
+                    munmap(mHeader, sizeof(RingHeader));
+                if (mDataEvent >= 0)
+                    ::close(mDataEvent);
+                if (mSpaceEvent >= 0)
+                    ::close(mSpaceEvent);
+                mData = nullptr;
+                mHeader = nullptr;
+                mDataEvent = mSpaceEvent = -1;
+            }
+            static void signal(int event) {
+                std::uint64_t one = 1;
+                while (::write(event, &one, sizeof(one)) < 0 && errno == EINTR) {
+                }
+            }
+            /*  Sleeps on event until the condition may have changed. waiting
+                is set first so the other side knows to signal, then the
+                caller's condition is checked again before sleeping.
+            */
+            template<typename Ready>
+            static void wait(int event, std::atomic<std::uint32_t>& waiting, Ready ready) {
+                waiting.store(1);
+                // pairs with the other side's update before it checks waiting
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!ready()) {
+                    std::uint64_t count;
+                    while (::read(event, &count, sizeof(count)) < 0 && errno == EINTR) {
+                    }
+                }
+                waiting.store(0);
+            }
+
+            RingHeader* mHeader     = nullptr;
+            char*       mData       = nullptr;
+            std::size_t mCapacity   = 0;
+            int         mDataEvent  = -1;
+            int         mSpaceEvent = -1;
+        };
+
+        /** Producer end of a ring. */
+        class RingWriter : public RingEnd {
+        public:
+            using RingEnd::RingEnd;
+            /** Takes fds base, base+1 & base+2. */
+            static RingWriter from_fds(int base) {
+                return RingWriter(base, base + 1, base + 2);
+            }
+            RingWriter(RingWriter&&)=default;
+            RingWriter& operator=(RingWriter&& other) {
+                close();
+                RingEnd::operator=(std::move(other));
+                return *this;
+            }
+            ~RingWriter() { close(); }
+
+            /** Copies all of data into the ring, blocking while it is full. */
+            void write(const void* data, std::size_t size) {
+                const char* pos = static_cast<const char*>(data);
+                while (size > 0) {
+                    std::size_t count = std::min(size, wait_space());
+                    std::memcpy(space(), pos, count);
+                    commit(count);
+                    pos += count;
+                    size -= count;
+                }
+            }
+            void write(std::string_view data) { write(data.data(), data.size()); }
+
+            /** Blocks until there is room. @return bytes that fit at space() */
+            std::size_t wait_space() {
+                std::size_t available = free_space();
+                while (available == 0) {
+                    wait(mSpaceEvent, mHeader->producer_waiting,
+                        [this]() { return free_space() > 0; });
+                    available = free_space();
+                }
+                return available;
+            }
+            /** Where to write the next bytes, contiguous for wait_space() bytes. */
+            char* space() {
+                return mData + (mHeader->head.load(std::memory_order_relaxed) & (mCapacity - 1));
+            }
+            /** Publishes count bytes written at space(). */
+            void commit(std::size_t count) {
+                mHeader->head.fetch_add(count);
+                if (mHeader->consumer_waiting.load())
+                    signal(mDataEvent);
+            }
+            /** The reader sees the end once it has read everything. */
+            void close() {
+                if (!mHeader || mHeader->closed.load())
+                    return;
+                mHeader->closed.store(1);
+                signal(mDataEvent);
+            }
+        private:
+            std::size_t free_space() const {
+                return mCapacity - (std::size_t)(mHeader->head.load(std::memory_order_relaxed)
+                    - mHeader->tail.load(std::memory_order_acquire));
+            }
+        };
+
+        /** Consumer end of a ring. */
+        class RingReader : public RingEnd {
+        public:
+            using RingEnd::RingEnd;
+            /** Takes fds base, base+1 & base+2. */
+            static RingReader from_fds(int base) {
+                return RingReader(base, base + 1, base + 2);
+            }
+
+            /** Blocks until data is available.
+
+                @return the readable bytes, contiguous and valid until
+                        consume(). Empty once the writer closed and all has
+                        been read.
+            */
+            std::string_view peek() {
+                std::size_t size = available();
+                while (size == 0) {
+                    if (mHeader->closed.load()) {
+                        // closed after the last commit, look once more
+                        size = available();
+                        if (size == 0)
+                            return {};
+                        break;
+                    }
+                    wait(mDataEvent, mHeader->consumer_waiting, [this]() {
+                        return available() > 0 || mHeader->closed.load();
+                    });
+                    size = available();
+                }
+                std::size_t offset = mHeader->tail.load(std::memory_order_relaxed) & (mCapacity - 1);
+                return std::string_view(mData + offset, size);
+            }
+            /** Frees count bytes of what peek() returned. */
+            void consume(std::size_t count) {
+                mHeader->tail.fetch_add(count);
+                if (mHeader->producer_waiting.load())
+                    signal(mSpaceEvent);
+            }
+            /** Reads up to size bytes. @return 0 at the end. */
+            std::size_t read(void* buffer, std::size_t size) {
+                std::string_view data = peek();
+                std::size_t count = std::min(size, data.size());
+                std::memcpy(buffer, data.data(), count);
+                consume(count);
+                return count;
+            }
+        private:
+            std::size_t available() const {
+                return (std::size_t)(mHeader->head.load(std::memory_order_acquire)
+                    - mHeader->tail.load(std::memory_order_relaxed));
+            }
+        };
+    }
+}
+#endif
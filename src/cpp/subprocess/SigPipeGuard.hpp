@@ -0,0 +1,55 @@
+/** @cond PRIVATE */
+#pragma once
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+namespace subprocess {
+    namespace details {
+        /** Blocks SIGPIPE on this thread while writing to a child, a child
+            exiting early must only fail the write with EPIPE. A SIGPIPE
+            raised meanwhile is consumed before the mask is restored.
+        */
+        class SigPipeGuard {
+        public:
+#ifdef _WIN32
+            SigPipeGuard(){}
+#else
+            SigPipeGuard() {
+                sigemptyset(&mSet);
+                sigaddset(&mSet, SIGPIPE);
+                pthread_sigmask(SIG_BLOCK, &mSet, &mOld);
+            }
+            ~SigPipeGuard() {
+                sigset_t pending;
+                sigpending(&pending);
+                if (sigismember(&pending, SIGPIPE) && !sigismember(&mOld, SIGPIPE)) {
+                    int signal;
+                    sigwait(&mSet, &signal);
+                }
+                pthread_sigmask(SIG_SETMASK, &mOld, nullptr);
+            }
+        private:
+            sigset_t mSet;
+            sigset_t mOld;
+#endif
+        };
+
+        /** Blocks SIGPIPE for the rest of a thread that feeds children, so
+            one exiting early only fails its writes with EPIPE. A SIGPIPE
+            raised meanwhile stays pending on the thread and is discarded
+            when it exits.
+        */
+        inline void block_sigpipe_on_this_thread() {
+#ifndef _WIN32
+            sigset_t sigpipe;
+            sigemptyset(&sigpipe);
+            sigaddset(&sigpipe, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+#endif
+        }
+    }
+}
+/** @endcond */
@@ -0,0 +1,46 @@
+#include "SpillCapture.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "TempFile.hpp"
+
+namespace subprocess {
+    SpillCapture::SpillCapture(std::size_t threshold) : mThreshold(threshold) {
+    }
+    SpillCapture::~SpillCapture() {
+    }
+
+    void SpillCapture::write(std::string_view chunk) {
+        mSize += chunk.size();
+        if (mFile) {
+            mFile->write(chunk.data(), chunk.size());
+            return;
+        }
+        if (mMemory.size() + chunk.size() <= mThreshold) {
+            mMemory.append(chunk.data(), chunk.size());
+            return;
+        }
+        mFile = std::make_unique<details::TempFile>();
+        mFile->write(mMemory.data(), mMemory.size());
+        mFile->write(chunk.data(), chunk.size());
+        // give the memory back, that's the whole point
+        std::string().swap(mMemory);
+    }
+
+    std::size_t SpillCapture::read(std::uint64_t offset, void* buffer, std::size_t size) const {
+        if (mFile)
+            return mFile->read_at(offset, buffer, size);
+        if (offset >= mMemory.size())
+            return 0;
+        size = std::min<std::size_t>(size, mMemory.size() - offset);
+        std::memcpy(buffer, mMemory.data() + offset, size);
+        return size;
+    }
+
+    std::string_view SpillCapture::view() {
+        if (mFile)
+            return mFile->map();
+        return mMemory;
+    }
+}
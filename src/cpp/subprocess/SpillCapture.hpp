@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "OutputSink.hpp"
+
+namespace subprocess {
+    namespace details {
+        class TempFile;
+    }
+    /** Captures output in memory up to a threshold, then transparently moves
+        it to an anonymous temporary file (O_TMPFILE on linux) so huge outputs
+        don't have to fit in RAM.
+
+        Use it as cout/cerr, once run() returns the output is available
+        through size(), a streaming Reader, or a read only memory mapped
+        view(). CompletedProcess::cout/cerr stay empty.
+    */
+    class SpillCapture : public OutputSink {
+    public:
+        /** @param threshold    Bytes kept in memory before spilling to disk. */
+        explicit SpillCapture(std::size_t threshold = 64*1024*1024);
+        ~SpillCapture();
+
+        void write(std::string_view chunk) override;
+
+        /** @return total number of bytes captured. */
+        std::uint64_t size() const { return mSize; }
+        /** @return true if the output went over the threshold and lives in
+                    a temporary file.
+        */
+        bool spilled() const { return !!mFile; }
+        /** Copies up to size bytes starting at offset into buffer.
+
+            @return number of bytes copied, 0 at the end.
+        */
+        std::size_t read(std::uint64_t offset, void* buffer, std::size_t size) const;
+        /** Views all of the output. If spilled the temporary file is memory
+            mapped, otherwise it's the in memory buffer. Valid until the next
+            write or destruction of this object.
+        */
+        std::string_view view();
+
+        /** Reads the captured output sequentially. */
+        class Reader {
+        public:
+            Reader(const SpillCapture& capture) : mCapture(&capture) {}
+            /** @return bytes read into buffer, 0 at the end. */
+            std::size_t read(void* buffer, std::size_t size) {
+                std::size_t transfered = mCapture->read(mOffset, buffer, size);
+                mOffset += transfered;
+                return transfered;
+            }
+            std::uint64_t tell() const { return mOffset; }
+        private:
+            const SpillCapture* mCapture;
+            std::uint64_t       mOffset = 0;
+        };
+        Reader reader() const { return Reader(*this); }
+    private:
+        std::size_t                         mThreshold;
+        std::uint64_t                       mSize = 0;
+        std::string                         mMemory;
+        std::unique_ptr<details::TempFile>  mFile;
+    };
+}
@@ -0,0 +1,199 @@
+#include "TempFile.hpp"
+
+#include <cstdlib>
+#include <string>
+
+#include "pipe.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+using namespace subprocess::details;
+
+namespace subprocess {
+    namespace details {
+#ifdef _WIN32
+        TempFile::TempFile(bool) {
+            wchar_t dir[MAX_PATH+1];
+            wchar_t path[MAX_PATH+1];
+            if (GetTempPathW(MAX_PATH+1, dir) == 0)
+                throw OSError("GetTempPathW failed");
+            if (GetTempFileNameW(dir, L"spo", 0, path) == 0)
+                throw OSError("GetTempFileNameW failed");
+            mHandle = CreateFileW(path, GENERIC_READ | GENERIC_WRITE,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                nullptr);
+            if (mHandle == INVALID_HANDLE_VALUE) {
+                DeleteFileW(path);
+                throw OSError("could not create temporary file");
+            }
+        }
+
+        TempFile::~TempFile() {
+            unmap();
+            if (mHandle != kBadPipeValue)
+                CloseHandle(mHandle);
+        }
+
+        void TempFile::write(const void* data, std::size_t size) {
+            unmap();
+            const char* pos = (const char*)data;
+            while (size > 0) {
+                // all 0xFF offset means append, reads don't disturb it
+                OVERLAPPED overlapped = {0};
+                overlapped.Offset       = 0xFFFFFFFF;
+                overlapped.OffsetHigh   = 0xFFFFFFFF;
+                DWORD written = 0;
+                DWORD chunk = size > 0x40000000? 0x40000000 : (DWORD)size;
+                if (!WriteFile(mHandle, pos, chunk, &written, &overlapped))
+                    throw OSError("WriteFile to temporary file failed");
+                pos  += written;
+                size -= written;
+            }
+        }
+
+        std::size_t TempFile::read_at(std::uint64_t offset, void* buffer, std::size_t size) const {
+            OVERLAPPED overlapped = {0};
+            overlapped.Offset       = (DWORD)offset;
+            overlapped.OffsetHigh   = (DWORD)(offset >> 32);
+            DWORD transfered = 0;
+            DWORD chunk = size > 0x40000000? 0x40000000 : (DWORD)size;
+            if (!ReadFile(mHandle, buffer, chunk, &transfered, &overlapped)) {
+                if (GetLastError() == ERROR_HANDLE_EOF)
+                    return 0;
+                throw OSError("ReadFile from temporary file failed");
+            }
+            return transfered;
+        }
+
+        std::uint64_t TempFile::size() const {
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(mHandle, &size))
+                throw OSError("GetFileSizeEx failed");
+            return size.QuadPart;
+        }
+
+        std::string_view TempFile::map() {
+            std::uint64_t size = this->size();
+            if (mMapped && mMappedSize == size)
+                return {mMapped, (std::size_t)size};
+            unmap();
+            if (size == 0)
+                return {};
+            mMapping = CreateFileMappingW(mHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mMapping == nullptr)
+                throw OSError("CreateFileMappingW failed");
+            mMapped = (const char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+            if (mMapped == nullptr) {
+                unmap();
+                throw OSError("MapViewOfFile failed");
+            }
+            mMappedSize = size;
+            return {mMapped, (std::size_t)size};
+        }
+
+        void TempFile::unmap() {
+            if (mMapped)
+                UnmapViewOfFile(mMapped);
+            if (mMapping)
+                CloseHandle(mMapping);
+            mMapped     = nullptr;
+            mMapping    = nullptr;
+            mMappedSize = 0;
+        }
+#else
+        TempFile::TempFile(bool in_memory) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+            if (in_memory) {
+                // syscall() as the glibc wrapper only exists since 2.27
+                mHandle = (PipeHandle)syscall(SYS_memfd_create, "subprocess", 1u /* MFD_CLOEXEC */);
+                if (mHandle >= 0)
+                    return;
+            }
+#endif
+            const char* tmpdir = std::getenv("TMPDIR");
+            std::string dir = tmpdir && *tmpdir? tmpdir : "/tmp";
+#ifdef O_TMPFILE
+            mHandle = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+            if (mHandle >= 0)
+                return;
+#endif
+            // no O_TMPFILE or the filesystem doesn't support it
+            std::string path = dir + "/subprocess-XXXXXX";
+            mHandle = mkstemp(&path[0]);
+            if (mHandle < 0)
+                throw_os_error("mkstemp", errno);
+            ::unlink(path.c_str());
+            pipe_set_inheritable(mHandle, false);
+        }
+
+        TempFile::~TempFile() {
+            unmap();
+            if (mHandle != kBadPipeValue)
+                ::close(mHandle);
+        }
+
+        void TempFile::write(const void* data, std::size_t size) {
+            unmap();
+            const char* pos = (const char*)data;
+            while (size > 0) {
+                ssize_t written = ::write(mHandle, pos, size);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written < 0)
+                    throw_os_error("write", errno);
+                pos  += written;
+                size -= written;
+            }
+        }
+
+        std::size_t TempFile::read_at(std::uint64_t offset, void* buffer, std::size_t size) const {
+            while (true) {
+                ssize_t transfered = ::pread(mHandle, buffer, size, (off_t)offset);
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+                if (transfered < 0)
+                    throw_os_error("pread", errno);
+                return transfered;
+            }
+        }
+
+        std::uint64_t TempFile::size() const {
+            struct stat info;
+            if (fstat(mHandle, &info) != 0)
+                throw_os_error("fstat", errno);
+            return info.st_size;
+        }
+
+        std::string_view TempFile::map() {
+            std::uint64_t size = this->size();
+            if (mMapped && mMappedSize == size)
+                return {mMapped, (std::size_t)size};
+            unmap();
+            if (size == 0)
+                return {};
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, mHandle, 0);
+            if (mapped == MAP_FAILED)
+                throw_os_error("mmap", errno);
+            mMapped     = (const char*)mapped;
+            mMappedSize = size;
+            return {mMapped, (std::size_t)size};
+        }
+
+        void TempFile::unmap() {
+            if (mMapped)
+                munmap((void*)mMapped, mMappedSize);
+            mMapped     = nullptr;
+            mMappedSize = 0;
+        }
+#endif
+    }
+}
@@ -0,0 +1,51 @@
+/** @cond PRIVATE */
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "basic_types.hpp"
+
+namespace subprocess {
+    namespace details {
+        /** An anonymous file that is gone once closed. On linux it's created
+            with O_TMPFILE so it never has a name, elsewhere it is unlinked
+            (or delete-on-close on windows) right after creation.
+        */
+        class TempFile {
+        public:
+            /** @param in_memory   Use memfd_create() on linux so the file is
+                                    backed by memory rather than a disk.
+                                    Elsewhere a regular temp file is used.
+            */
+            explicit TempFile(bool in_memory=false);
+            ~TempFile();
+            TempFile(const TempFile&)=delete;
+            TempFile& operator=(const TempFile&)=delete;
+
+            PipeHandle handle() const { return mHandle; }
+            /** Appends data at the end of the file. Throws OSError on failure. */
+            void write(const void* data, std::size_t size);
+            /** Reads from offset without moving the file position.
+
+                @return bytes read, 0 at end of file.
+            */
+            std::size_t read_at(std::uint64_t offset, void* buffer, std::size_t size) const;
+            /** @return current size of the file. */
+            std::uint64_t size() const;
+            /** Maps the whole file read only. The view stays valid until
+                unmap(), the next write() or destruction.
+            */
+            std::string_view map();
+            void unmap();
+        private:
+            PipeHandle      mHandle     = kBadPipeValue;
+            const char*     mMapped     = nullptr;
+            std::uint64_t   mMappedSize = 0;
+#ifdef _WIN32
+            HANDLE          mMapping    = nullptr;
+#endif
+        };
+    }
+}
+/** @endcond */
@@ -0,0 +1,351 @@
+#include "Transform.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "simd.hpp"
+
+using subprocess::details::find_byte;
+
+namespace {
+    // LZ4 block format limits: the last 5 bytes are always literals and
+    // the last match starts at least 12 bytes before the end
+    constexpr std::size_t kLastLiterals = 5;
+    constexpr std::size_t kMatchStartLimit = 12;
+    constexpr std::size_t kMinMatch = 4;
+    constexpr int kHashBits = 12;
+    constexpr std::size_t kMaxBlockSize = 64*1024;
+    constexpr std::size_t kHeaderSize = 8;
+
+    inline std::uint32_t load32(const unsigned char* p) {
+        std::uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    inline std::uint32_t load32_le(const unsigned char* p) {
+        return (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8)
+            | ((std::uint32_t)p[2] << 16) | ((std::uint32_t)p[3] << 24);
+    }
+    inline void store32_le(unsigned char* p, std::uint32_t value) {
+        p[0] = (unsigned char)value;
+        p[1] = (unsigned char)(value >> 8);
+        p[2] = (unsigned char)(value >> 16);
+        p[3] = (unsigned char)(value >> 24);
+    }
+    inline std::uint32_t hash4(std::uint32_t sequence) {
+        return (sequence*2654435761u) >> (32 - kHashBits);
+    }
+
+    /*  The part of a length that doesn't fit in its 4 bits of the token,
+        as bytes of 255 and a final one below.
+    */
+    unsigned char* write_length(unsigned char* out, std::size_t length) {
+        length -= 15;
+        for (; length >= 255; length -= 255)
+            *out++ = 255;
+        *out++ = (unsigned char)length;
+        return out;
+    }
+
+    unsigned char* write_literals(unsigned char* out, unsigned char& token,
+        const unsigned char* literals, std::size_t size) {
+        token = (unsigned char)(std::min<std::size_t>(size, 15) << 4);
+        if (size >= 15)
+            out = write_length(out, size);
+        std::memcpy(out, literals, size);
+        return out + size;
+    }
+
+    unsigned char* write_sequence(unsigned char* out, const unsigned char* literals,
+        std::size_t literal_size, std::size_t offset, std::size_t match_size) {
+        unsigned char& token = *out++;
+        out = write_literals(out, token, literals, literal_size);
+        *out++ = (unsigned char)offset;
+        *out++ = (unsigned char)(offset >> 8);
+        match_size -= kMinMatch;
+        token |= (unsigned char)std::min<std::size_t>(match_size, 15);
+        if (match_size >= 15)
+            out = write_length(out, match_size);
+        return out;
+    }
+
+    /*  Reads the rest of a length whose token bits are 15. */
+    std::size_t read_length(const unsigned char*& pos, const unsigned char* end) {
+        std::size_t length = 15;
+        while (true) {
+            if (pos == end)
+                throw std::runtime_error("BlockCompressor: truncated block");
+            unsigned char byte = *pos++;
+            length += byte;
+            if (byte != 255)
+                return length;
+        }
+    }
+
+    void decompress_block(const unsigned char* pos, const unsigned char* end,
+        char* out, std::size_t size) {
+        char* const start = out;
+        char* const out_end = out + size;
+        while (true) {
+            if (pos == end)
+                throw std::runtime_error("BlockCompressor: truncated block");
+            unsigned char token = *pos++;
+            std::size_t literals = token >> 4;
+            if (literals == 15)
+                literals = read_length(pos, end);
+            if ((std::size_t)(end - pos) < literals || (std::size_t)(out_end - out) < literals)
+                throw std::runtime_error("BlockCompressor: corrupt block");
+            std::memcpy(out, pos, literals);
+            out += literals;
+            pos += literals;
+            // the last sequence has no match
+            if (pos == end)
+                break;
+            if (end - pos < 2)
+                throw std::runtime_error("BlockCompressor: truncated block");
+            std::size_t offset = pos[0] | (pos[1] << 8);
+            pos += 2;
+            std::size_t match = token & 15;
+            if (match == 15)
+                match = read_length(pos, end);
+            match += kMinMatch;
+            if (offset == 0 || offset > (std::size_t)(out - start)
+                || (std::size_t)(out_end - out) < match)
+                throw std::runtime_error("BlockCompressor: corrupt block");
+            const char* from = out - offset;
+            if (offset >= match) {
+                std::memcpy(out, from, match);
+                out += match;
+            } else {
+                // overlapping, repeats the last offset bytes
+                for (std::size_t i = 0; i < match; ++i)
+                    *out++ = from[i];
+            }
+        }
+        if (out != out_end)
+            throw std::runtime_error("BlockCompressor: corrupt block");
+    }
+}
+
+namespace subprocess {
+    std::shared_ptr<LineFilter> LineFilter::containing(std::string text, bool invert) {
+        return std::make_shared<LineFilter>(
+            [text(std::move(text)), invert](std::string_view line) {
+                return (line.find(text) != std::string_view::npos) != invert;
+            });
+    }
+
+    void LineFilter::transform(char* data, std::size_t size, const Emit& emit) {
+        char* pos = data;
+        char* const end = data + size;
+        if (!mPartial.empty()) {
+            char* newline = const_cast<char*>(find_byte(pos, end, '\n'));
+            if (newline == end) {
+                mPartial.append(pos, end - pos);
+                return;
+            }
+            mPartial.append(pos, newline + 1 - pos);
+            if (mKeep(std::string_view(mPartial.data(), mPartial.size() - 1)))
+                emit(&mPartial[0], mPartial.size());
+            mPartial.clear();
+            pos = newline + 1;
+        }
+        // kept lines are moved down over the dropped ones
+        char* const start = pos;
+        char* out = pos;
+        while (pos < end) {
+            char* newline = const_cast<char*>(find_byte(pos, end, '\n'));
+            if (newline == end) {
+                mPartial.assign(pos, end - pos);
+                break;
+            }
+            std::size_t length = newline + 1 - pos;
+            if (mKeep(std::string_view(pos, length - 1))) {
+                if (out != pos)
+                    std::memmove(out, pos, length);
+                out += length;
+            }
+            pos = newline + 1;
+        }
+        if (out != start)
+            emit(start, out - start);
+    }
+
+    void LineFilter::finish(const Emit& emit) {
+        if (!mPartial.empty() && mKeep(mPartial))
+            emit(&mPartial[0], mPartial.size());
+        mPartial.clear();
+    }
+
+    void CrlfToLf::transform(char* data, std::size_t size, const Emit& emit) {
+        if (size == 0)
+            return;
+        if (mPendingCr) {
+            mPendingCr = false;
+            if (data[0] != '\n') {
+                char cr = '\r';
+                emit(&cr, 1);
+            }
+        }
+        const char* pos = data;
+        const char* const end = data + size;
+        char* out = data;
+        while (pos < end) {
+            const char* cr = find_byte(pos, end, '\r');
+            std::size_t length = cr - pos;
+            if (out != pos)
+                std::memmove(out, pos, length);
+            out += length;
+            if (cr == end)
+                break;
+            if (cr + 1 == end) {
+                mPendingCr = true;
+                break;
+            }
+            // dropped before '\n', which is copied with the next run
+            if (cr[1] != '\n')
+                *out++ = '\r';
+            pos = cr + 1;
+        }
+        if (out != data)
+            emit(data, out - data);
+    }
+
+    void CrlfToLf::finish(const Emit& emit) {
+        if (mPendingCr) {
+            mPendingCr = false;
+            char cr = '\r';
+            emit(&cr, 1);
+        }
+    }
+
+    BlockCompressor::BlockCompressor(std::size_t block_size) : mBlockSize(block_size) {
+        if (block_size == 0 || block_size > kMaxBlockSize)
+            throw std::invalid_argument("BlockCompressor: block_size must be 1 to 64K");
+        mTable.resize(std::size_t(1) << kHashBits);
+    }
+
+    void BlockCompressor::transform(char* data, std::size_t size, const Emit& emit) {
+        if (!mPending.empty()) {
+            std::size_t take = std::min(size, mBlockSize - mPending.size());
+            mPending.append(data, take);
+            data += take;
+            size -= take;
+            if (mPending.size() < mBlockSize)
+                return;
+            compress_block(mPending.data(), mPending.size(), emit);
+            mPending.clear();
+        }
+        // whole blocks straight from the chunk
+        for (; size >= mBlockSize; data += mBlockSize, size -= mBlockSize)
+            compress_block(data, mBlockSize, emit);
+        mPending.assign(data, size);
+    }
+
+    void BlockCompressor::finish(const Emit& emit) {
+        if (!mPending.empty())
+            compress_block(mPending.data(), mPending.size(), emit);
+        mPending.clear();
+    }
+
+    /*  Greedy LZ77: a hash of the next 4 bytes finds the last position they
+        were seen at, a match is extended as far as it goes, otherwise the
+        scan skips ahead faster the longer it found nothing.
+    */
+    void BlockCompressor::compress_block(const char* data, std::size_t size, const Emit& emit) {
+        // worst case, incompressible data costs a length byte per 255
+        mOutput.resize(kHeaderSize + size + size/255 + 16);
+        unsigned char* const begin = reinterpret_cast<unsigned char*>(&mOutput[0]);
+        unsigned char* out = begin + kHeaderSize;
+        const unsigned char* base = reinterpret_cast<const unsigned char*>(data);
+        std::size_t anchor = 0;
+        if (size > kMatchStartLimit) {
+            std::fill(mTable.begin(), mTable.end(), 0);
+            const std::size_t match_start_limit = size - kMatchStartLimit;
+            const std::size_t match_end_limit = size - kLastLiterals;
+            std::size_t pos = 0;
+            while (pos < match_start_limit) {
+                std::uint32_t sequence = load32(base + pos);
+                std::uint16_t& slot = mTable[hash4(sequence)];
+                std::size_t candidate = slot;
+                slot = (std::uint16_t)pos;
+                if (candidate >= pos || load32(base + candidate) != sequence) {
+                    pos += 1 + ((pos - anchor) >> 6);
+                    continue;
+                }
+                while (pos > anchor && candidate > 0 && base[pos - 1] == base[candidate - 1]) {
+                    --pos;
+                    --candidate;
+                }
+                std::size_t length = kMinMatch;
+                while (pos + length < match_end_limit && base[pos + length] == base[candidate + length])
+                    ++length;
+                out = write_sequence(out, base + anchor, pos - anchor, pos - candidate, length);
+                pos += length;
+                anchor = pos;
+            }
+        }
+        unsigned char& token = *out++;
+        out = write_literals(out, token, base + anchor, size - anchor);
+
+        std::size_t payload = out - begin - kHeaderSize;
+        if (payload >= size) {
+            std::memcpy(begin + kHeaderSize, data, size);
+            payload = size;
+        }
+        store32_le(begin, (std::uint32_t)size);
+        store32_le(begin + 4, (std::uint32_t)payload);
+        emit(&mOutput[0], kHeaderSize + payload);
+    }
+
+    std::string BlockCompressor::decompress(std::string_view data) {
+        std::string output;
+        const unsigned char* pos = reinterpret_cast<const unsigned char*>(data.data());
+        const unsigned char* const end = pos + data.size();
+        while (pos < end) {
+            if (end - pos < (std::ptrdiff_t)kHeaderSize)
+                throw std::runtime_error("BlockCompressor: truncated header");
+            std::size_t size = load32_le(pos);
+            std::size_t payload = load32_le(pos + 4);
+            pos += kHeaderSize;
+            if (size > kMaxBlockSize || payload > size)
+                throw std::runtime_error("BlockCompressor: corrupt header");
+            if ((std::size_t)(end - pos) < payload)
+                throw std::runtime_error("BlockCompressor: truncated block");
+            std::size_t offset = output.size();
+            output.resize(offset + size);
+            if (payload == size)
+                std::memcpy(&output[offset], pos, size);
+            else
+                decompress_block(pos, pos + payload, &output[offset], size);
+            pos += payload;
+        }
+        return output;
+    }
+
+    namespace details {
+        TransformPipeline::TransformPipeline(TransformStages stages,
+            std::function<void(std::string_view chunk)> output)
+        : mStages(std::move(stages)), mOutput(std::move(output)) {
+            mEmits.resize(mStages.size() + 1);
+            mEmits.back() = [this](char* data, std::size_t size) {
+                mOutput(std::string_view(data, size));
+            };
+            for (std::size_t i = 0; i < mStages.size(); ++i) {
+                TransformStage* stage = mStages[i].get();
+                if (stage == nullptr)
+                    throw std::invalid_argument("TransformPipeline: stage is null");
+                const TransformStage::Emit* next = &mEmits[i + 1];
+                mEmits[i] = [stage, next](char* data, std::size_t size) {
+                    stage->transform(data, size, *next);
+                };
+            }
+        }
+
+        void TransformPipeline::finish() {
+            for (std::size_t i = 0; i < mStages.size(); ++i)
+                mStages[i]->finish(mEmits[i + 1]);
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace subprocess {
+    /** A step processing a redirected output stream between the child's
+        pipe and where the output goes, e.g. dropping lines or compressing.
+        Doing it in process saves spawning a `| grep` or `| gzip` child and
+        copying everything through another pipe.
+
+        A stage keeps state across chunks, use a new one for every stream.
+    */
+    class TransformStage {
+    public:
+        /** Passes output on to the next stage. The memory is writable, the
+            receiver may transform it in place, and is only valid for the
+            duration of the call.
+        */
+        typedef std::function<void(char* data, std::size_t size)> Emit;
+
+        virtual ~TransformStage(){}
+        /** Transforms the next chunk and passes the result to emit, in any
+            number of pieces. data is writable and only valid for the
+            duration of the call. Transforming in place and emitting data
+            itself avoids a copy.
+        */
+        virtual void transform(char* data, std::size_t size, const Emit& emit) = 0;
+        /** Called once after the last chunk to emit what was held back. */
+        virtual void finish(const Emit& /*emit*/) {}
+    };
+
+    /** Stages applied in order to one stream. */
+    typedef std::vector<std::shared_ptr<TransformStage>> TransformStages;
+
+    /** Keeps the lines for which a predicate is true, like grep. Lines are
+        compacted in place, only a line crossing a chunk boundary is copied.
+        A final line without a trailing newline is kept or dropped the same
+        way.
+    */
+    class LineFilter : public TransformStage {
+    public:
+        /** @param keep  called with each line, without the '\n'. */
+        LineFilter(std::function<bool(std::string_view line)> keep)
+        : mKeep(std::move(keep)) {}
+        /** Keeps the lines containing text, or those without with invert,
+            like grep -F and grep -vF.
+        */
+        static std::shared_ptr<LineFilter> containing(std::string text, bool invert=false);
+
+        void transform(char* data, std::size_t size, const Emit& emit) override;
+        void finish(const Emit& emit) override;
+    private:
+        std::function<bool(std::string_view line)> mKeep;
+        std::string mPartial;
+    };
+
+    /** Turns "\r\n" into "\n", in place. A '\r' ending a chunk is held back
+        until the next one shows whether a '\n' follows. Lone '\r' are kept.
+    */
+    class CrlfToLf : public TransformStage {
+    public:
+        void transform(char* data, std::size_t size, const Emit& emit) override;
+        void finish(const Emit& emit) override;
+    private:
+        bool mPendingCr = false;
+    };
+
+    /** Compresses the stream in blocks with a fast LZ77 coder, much cheaper
+        than gzip for logs and other repetitive output, at a lower ratio.
+
+        Each block is an 8 byte header, the little endian uint32 sizes of
+        the uncompressed data and of the payload, followed by the payload in
+        the LZ4 block format. A payload as large as the data is the data
+        stored as is, when it didn't compress. Read it back with
+        decompress().
+    */
+    class BlockCompressor : public TransformStage {
+    public:
+        /** @param block_size   uncompressed bytes per block, at most 64K
+                                as matches reach back at most that far.
+        */
+        explicit BlockCompressor(std::size_t block_size = 64*1024);
+
+        void transform(char* data, std::size_t size, const Emit& emit) override;
+        void finish(const Emit& emit) override;
+
+        /** @return the data a BlockCompressor's output was made of.
+
+            @throw std::runtime_error if data is truncated or corrupt.
+        */
+        static std::string decompress(std::string_view data);
+    private:
+        void compress_block(const char* data, std::size_t size, const Emit& emit);
+
+        std::size_t                 mBlockSize;
+        std::string                 mPending;
+        std::string                 mOutput;
+        std::vector<std::uint16_t>  mTable;
+    };
+
+    /** @cond PRIVATE */
+    namespace details {
+        /*  Runs chunks through stages, the last one emitting to output.
+            With no stages chunks go straight to output.
+        */
+        class TransformPipeline {
+        public:
+            TransformPipeline(TransformStages stages,
+                std::function<void(std::string_view chunk)> output);
+            TransformPipeline(const TransformPipeline&)=delete;
+            TransformPipeline& operator=(const TransformPipeline&)=delete;
+
+            void write(char* data, std::size_t size) { mEmits.front()(data, size); }
+            /** Finishes the stages in order, flushing each into the next. */
+            void finish();
+        private:
+            TransformStages                             mStages;
+            std::function<void(std::string_view chunk)> mOutput;
+            // mEmits[i] feeds stage i, the last one output
+            std::vector<TransformStage::Emit>           mEmits;
+        };
+    }
+    /** @endcond */
+}
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #endif
 
+#include <cstdint>
 #include <map>
 #include <stdexcept>
 #include <string>
@@ -98,6 +99,8 @@ namespace subprocess {
 
     typedef std::vector<std::string> CommandLine;
     typedef std::map<std::string, std::string> EnvMap;
+    /** Child fd number -> parent handle to appear as that fd */
+    typedef std::map<int, PipeHandle> FdMap;
 
     /** Redirect destination */
     enum class PipeOption : int {
@@ -109,7 +112,18 @@ namespace subprocess {
         */
         specific,
         pipe,       ///< Redirects to a new handle created for you.
-        close       ///< Troll the child by providing a closed pipe.
+        close,      ///< Troll the child by providing a closed pipe.
+        /** Redirects to the null device. It is opened by the child so no
+            handle or thread is needed in the parent.
+        */
+        devnull,
+        path,       ///< Redirects to a file opened by the child. See FileRedirect
+        /** Like pipe but a socketpair(AF_UNIX, SOCK_STREAM). When used for
+            both cin & cout they share one socket, Popen::cout is a duplicate
+            of Popen::cin. Its buffers can be tuned with
+            RunOptions::socket_send_buffer & socket_receive_buffer. posix only.
+        */
+        socketpair
     };
 
     struct SubprocessError : std::runtime_error {
@@ -141,6 +155,10 @@ namespace subprocess {
         std::string cout;
         /** captured stderr */
         std::string cerr;
+        /** Bytes of stdout not retained by a TailCapture */
+        std::size_t cout_dropped = 0;
+        /** Bytes of stderr not retained by a TailCapture */
+        std::size_t cerr_dropped = 0;
     };
 
     struct CalledProcessError : SubprocessError {
@@ -158,6 +176,29 @@ namespace subprocess {
         std::string cout;
         /** stderr output if it was captured. */
         std::string cerr;
+        /** Bytes of stdout not retained by a TailCapture */
+        std::size_t cout_dropped = 0;
+        /** Bytes of stderr not retained by a TailCapture */
+        std::size_t cerr_dropped = 0;
+    };
+
+    /** Digests run() can compute over output as it is read, combine as
+        flags in RunOptions::cout_digest & cerr_digest.
+    */
+    enum DigestKind {
+        /** CRC32C (Castagnoli), hardware accelerated with SSE4.2. */
+        kDigestCrc32c   = 1,
+        /** XXH64 with seed 0. */
+        kDigestXxh64    = 2
+    };
+    /** Digests of a stream of output, see DigestKind. */
+    struct OutputDigest {
+        /** DigestKind flags of the digests computed, 0 if none. */
+        int             kinds   = 0;
+        std::uint32_t   crc32c  = 0;
+        std::uint64_t   xxh64   = 0;
+        /** Bytes digested. */
+        std::uint64_t   size    = 0;
     };
 
     /** Details about a completed process. */
@@ -172,6 +213,18 @@ namespace subprocess {
         std::string     cout;
         /** Captured stderr */
         std::string     cerr;
+        /** Bytes of stdout not retained by a TailCapture */
+        std::size_t     cout_dropped = 0;
+        /** Bytes of stderr not retained by a TailCapture */
+        std::size_t     cerr_dropped = 0;
+        /** Index of the RunOptions::stop pattern that ended the process,
+            -1 if it ran to completion.
+        */
+        int             matched = -1;
+        /** Digest of all of stdout, when asked for by RunOptions::cout_digest */
+        OutputDigest    cout_digest;
+        /** Digest of all of stderr, when asked for by RunOptions::cerr_digest */
+        OutputDigest    cerr_digest;
         explicit operator bool() const {
             return returncode == 0;
         }
@@ -1,10 +1,21 @@
 #include "pipe.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <memory>
 #include <thread>
+#include <vector>
+
+#include "ProcessBuilder.hpp"
 
 #ifndef _WIN32
+#include <climits>
 #include <fcntl.h>
-#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 using namespace subprocess::details;
@@ -46,6 +57,13 @@ namespace subprocess {
             throw OSError("SetHandleInformation failed");
         }
     }
+    void pipe_set_nonblocking(PipeHandle handle, bool nonblocking) {
+        if (handle == kBadPipeValue)
+            throw std::invalid_argument("pipe_set_nonblocking: handle is invalid");
+        DWORD mode = PIPE_READMODE_BYTE | (nonblocking? PIPE_NOWAIT : PIPE_WAIT);
+        if (!SetNamedPipeHandleState(handle, &mode, nullptr, nullptr))
+            throw OSError("SetNamedPipeHandleState failed");
+    }
     bool pipe_close(PipeHandle handle) {
         return !!CloseHandle(handle);
     }
@@ -61,22 +79,117 @@ namespace subprocess {
         }
         return {input, output};
     }
+    PipePair socket_create(bool) {
+        throw std::domain_error("socket_create is not supported on windows");
+    }
+    void socket_set_buffers(PipeHandle, int, int) {
+        throw std::domain_error("socket_set_buffers is not supported on windows");
+    }
+    void socket_shutdown_write(PipeHandle) {
+    }
     ssize_t pipe_read(PipeHandle handle, void* buffer, std::size_t size) {
         DWORD bread = 0;
         bool result = ReadFile(handle, buffer, (DWORD)size, &bread, nullptr);
         if (result)
             return bread;
+        // PIPE_NOWAIT and empty
+        if (GetLastError() == ERROR_NO_DATA)
+            errno = EAGAIN;
         return -1;
     }
 
     ssize_t pipe_write(PipeHandle handle, const void* buffer, size_t size) {
         DWORD written = 0;
         bool result = WriteFile(handle, buffer, (DWORD)size, &written, nullptr);
+        // PIPE_NOWAIT writes nothing when full
+        if (result && written == 0 && size > 0) {
+            errno = EAGAIN;
+            return -1;
+        }
         if (result)
             return written;
         return -1;
     }
 
+    ssize_t pipe_writev(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+        ssize_t total = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            if (buffers[i].size == 0)
+                continue;
+            ssize_t transfered = pipe_write(handle, buffers[i].data, buffers[i].size);
+            if (transfered < 0)
+                return total > 0? total : -1;
+            total += transfered;
+            if ((std::size_t)transfered < buffers[i].size)
+                break;
+        }
+        return total;
+    }
+
+    ssize_t pipe_readv(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+        // one ReadFile, a pipe returns what is there anyway
+        for (std::size_t i = 0; i < count; ++i) {
+            if (buffers[i].size > 0)
+                return pipe_read(handle, buffers[i].data, buffers[i].size);
+        }
+        return 0;
+    }
+
+    ssize_t pipe_try_writev(PipeHandle, const PipeBuffer*, std::size_t) {
+        throw std::domain_error("pipe_try_writev is not supported on windows");
+    }
+
+    ssize_t pipe_try_readv(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+        DWORD available = 0;
+        if (!PeekNamedPipe(handle, nullptr, 0, nullptr, &available, nullptr))
+            return 0;
+        if (available == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        ssize_t total = 0;
+        for (std::size_t i = 0; i < count && available > 0; ++i) {
+            DWORD size = (DWORD)std::min<std::size_t>(buffers[i].size, available);
+            if (size == 0)
+                continue;
+            ssize_t transfered = pipe_read(handle, buffers[i].data, size);
+            if (transfered <= 0)
+                break;
+            total += transfered;
+            available -= (DWORD)transfered;
+        }
+        return total;
+    }
+
+    int pipe_poll(PipePoll* entries, std::size_t count, double deadline) {
+        while (true) {
+            int ready_count = 0;
+            for (std::size_t i = 0; i < count; ++i) {
+                PipePoll& entry = entries[i];
+                entry.ready = 0;
+                if (entry.handle == kBadPipeValue)
+                    continue;
+                if (entry.events & kPipeReadable) {
+                    DWORD available = 0;
+                    // fails once the other end is closed
+                    if (!PeekNamedPipe(entry.handle, nullptr, 0, nullptr, &available, nullptr))
+                        entry.ready |= kPipeReadable | kPipeClosed;
+                    else if (available > 0)
+                        entry.ready |= kPipeReadable;
+                }
+                if (entry.events & kPipeWritable)
+                    entry.ready |= kPipeWritable;
+                if (entry.ready)
+                    ++ready_count;
+            }
+            if (ready_count > 0)
+                return ready_count;
+            if (deadline >= 0 && monotonic_seconds() >= deadline)
+                return 0;
+            sleep_seconds(0.001);
+        }
+    }
+
 #else
     void pipe_set_inheritable(PipeHandle handle, bool inherits) {
         if (handle == kBadPipeValue)
@@ -92,6 +205,19 @@ namespace subprocess {
         if (result < -1)
             throw_os_error("fcntl", errno);
     }
+    void pipe_set_nonblocking(PipeHandle handle, bool nonblocking) {
+        if (handle == kBadPipeValue)
+            throw std::invalid_argument("pipe_set_nonblocking: handle is invalid");
+        int flags = fcntl(handle, F_GETFL);
+        if (flags < 0)
+            throw_os_error("fcntl", errno);
+        if (nonblocking)
+            flags |= O_NONBLOCK;
+        else
+            flags &= ~O_NONBLOCK;
+        if (fcntl(handle, F_SETFL, flags) < 0)
+            throw_os_error("fcntl", errno);
+    }
     bool pipe_close(PipeHandle handle) {
         if (handle == kBadPipeValue)
             return false;
@@ -100,6 +226,14 @@ namespace subprocess {
 
     PipePair pipe_create(bool inheritable) {
         int fd[2];
+#ifdef __linux__
+        // atomically, a concurrent spawn can't inherit them meanwhile
+        if (!inheritable) {
+            if (::pipe2(fd, O_CLOEXEC) != 0)
+                throw_os_error("pipe2", errno);
+            return {fd[0], fd[1]};
+        }
+#endif
         bool success =!::pipe(fd);
         if (!success) {
             throw_os_error("pipe", errno);
@@ -112,6 +246,34 @@ namespace subprocess {
         return {fd[0], fd[1]};
     }
 
+    PipePair socket_create(bool inheritable) {
+        int fd[2];
+        int type = SOCK_STREAM;
+#ifdef SOCK_CLOEXEC
+        if (!inheritable)
+            type |= SOCK_CLOEXEC;
+#endif
+        if (::socketpair(AF_UNIX, type, 0, fd) != 0)
+            throw_os_error("socketpair", errno);
+        if (!inheritable) {
+            pipe_set_inheritable(fd[0], false);
+            pipe_set_inheritable(fd[1], false);
+        }
+        return {fd[0], fd[1]};
+    }
+
+    void socket_set_buffers(PipeHandle handle, int send, int receive) {
+        if (send > 0 && setsockopt(handle, SOL_SOCKET, SO_SNDBUF, &send, sizeof(send)) != 0)
+            throw_os_error("setsockopt", errno);
+        if (receive > 0 && setsockopt(handle, SOL_SOCKET, SO_RCVBUF, &receive, sizeof(receive)) != 0)
+            throw_os_error("setsockopt", errno);
+    }
+
+    void socket_shutdown_write(PipeHandle handle) {
+        if (handle != kBadPipeValue)
+            ::shutdown(handle, SHUT_WR);
+    }
+
     ssize_t pipe_read(PipeHandle handle, void* buffer, size_t size) {
         return ::read(handle, buffer, size);
     }
@@ -119,22 +281,293 @@ namespace subprocess {
     ssize_t pipe_write(PipeHandle handle, const void* buffer, size_t size) {
         return ::write(handle, buffer, size);
     }
+
+    static_assert(sizeof(PipeBuffer) == sizeof(iovec)
+        && offsetof(PipeBuffer, data) == offsetof(iovec, iov_base)
+        && offsetof(PipeBuffer, size) == offsetof(iovec, iov_len),
+        "PipeBuffer must match iovec");
+
+    static const iovec* to_iovec(const PipeBuffer* buffers) {
+        return reinterpret_cast<const iovec*>(buffers);
+    }
+    static int iov_count(std::size_t count) {
+#ifdef IOV_MAX
+        return (int)std::min<std::size_t>(count, IOV_MAX);
+#else
+        return (int)std::min<std::size_t>(count, 1024);
+#endif
+    }
+
+    ssize_t pipe_writev(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+        return ::writev(handle, to_iovec(buffers), iov_count(count));
+    }
+
+    ssize_t pipe_readv(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+        return ::readv(handle, to_iovec(buffers), iov_count(count));
+    }
+
+    ssize_t pipe_try_writev(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+#ifdef RWF_NOWAIT
+        ssize_t result = ::pwritev2(handle, to_iovec(buffers), iov_count(count), -1, RWF_NOWAIT);
+        if (result >= 0 || (errno != EOPNOTSUPP && errno != EINVAL && errno != ENOSYS))
+            return result;
+#endif
+        PipePoll entry = {handle, kPipeWritable};
+        if (pipe_poll(&entry, 1, 0) == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        // a pipe with room takes PIPE_BUF bytes without blocking
+        PipeBuffer limited[16];
+        std::size_t limited_count = 0;
+        std::size_t room = PIPE_BUF;
+        for (std::size_t i = 0; i < count && room > 0 && limited_count < 16; ++i) {
+            std::size_t size = std::min(buffers[i].size, room);
+            limited[limited_count++] = PipeBuffer(buffers[i].data, size);
+            room -= size;
+        }
+        return pipe_writev(handle, limited, limited_count);
+    }
+
+    ssize_t pipe_try_readv(PipeHandle handle, const PipeBuffer* buffers, std::size_t count) {
+#ifdef RWF_NOWAIT
+        ssize_t result = ::preadv2(handle, to_iovec(buffers), iov_count(count), -1, RWF_NOWAIT);
+        if (result >= 0 || (errno != EOPNOTSUPP && errno != EINVAL && errno != ENOSYS))
+            return result;
+#endif
+        PipePoll entry = {handle, kPipeReadable};
+        if (pipe_poll(&entry, 1, 0) == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return pipe_readv(handle, buffers, count);
+    }
+
+    int pipe_poll(PipePoll* entries, std::size_t count, double deadline) {
+        pollfd stack_fds[8];
+        std::vector<pollfd> heap_fds;
+        pollfd* fds = stack_fds;
+        if (count > 8) {
+            heap_fds.resize(count);
+            fds = &heap_fds[0];
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            short events = 0;
+            if (entries[i].events & kPipeReadable)
+                events |= POLLIN;
+            if (entries[i].events & kPipeWritable)
+                events |= POLLOUT;
+            // negative fds are ignored by poll()
+            fds[i] = {entries[i].handle == kBadPipeValue? -1 : entries[i].handle, events, 0};
+        }
+        while (true) {
+            int timeout = -1;
+            if (deadline >= 0)
+                timeout = (int)std::ceil(std::max(0.0, deadline - monotonic_seconds())*1000);
+            int result = poll(fds, count, timeout);
+            if (result >= 0)
+                break;
+            if (errno != EINTR)
+                throw_os_error("poll", errno);
+        }
+        int ready_count = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            short revents = fds[i].revents;
+            int ready = 0;
+            if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                // reading or writing won't block, it ends or fails
+                ready |= kPipeClosed | (entries[i].events & (kPipeReadable | kPipeWritable));
+            }
+            if (revents & POLLIN)
+                ready |= kPipeReadable;
+            if (revents & POLLOUT)
+                ready |= kPipeWritable;
+            entries[i].ready = ready;
+            if (ready)
+                ++ready_count;
+        }
+        return ready_count;
+    }
+#endif
+
+    ssize_t pipe_try_read(PipeHandle handle, void* buffer, std::size_t size) {
+        PipeBuffer buffers(buffer, size);
+        return pipe_try_readv(handle, &buffers, 1);
+    }
+
+    ssize_t pipe_try_write(PipeHandle handle, const void* buffer, std::size_t size) {
+        PipeBuffer buffers(buffer, size);
+        return pipe_try_writev(handle, &buffers, 1);
+    }
+
+    std::size_t pipe_write_all(PipeHandle handle, const void* data, std::size_t size) {
+        PipeBuffer buffer(data, size);
+        return pipe_writev_all(handle, &buffer, 1);
+    }
+
+    std::size_t pipe_writev_all(PipeHandle handle, PipeBuffer* buffers, std::size_t count) {
+        std::size_t total = 0;
+        while (count > 0) {
+            if (buffers->size == 0) {
+                ++buffers;
+                --count;
+                continue;
+            }
+            ssize_t transfered = pipe_writev(handle, buffers, count);
+            if (transfered < 0) {
+#ifndef _WIN32
+                if (errno == EINTR)
+                    continue;
+#endif
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    PipePoll entry = {handle, kPipeWritable};
+                    pipe_poll(&entry, 1);
+                    continue;
+                }
+                break;
+            }
+            if (transfered == 0)
+                break;
+            total += transfered;
+            // skip what was written, the last one may be partial
+            std::size_t written = transfered;
+            while (count > 0 && written >= buffers->size) {
+                written -= buffers->size;
+                ++buffers;
+                --count;
+            }
+            if (written > 0) {
+                buffers->data = (char*)buffers->data + written;
+                buffers->size -= written;
+            }
+        }
+        return total;
+    }
+
+    /*  pipe_splice() through a buffer, for handles splice() can't take. */
+    static ssize_t copy_some(PipeHandle input, PipeHandle output, std::size_t size,
+        std::vector<char>& buffer) {
+        if (buffer.empty())
+            buffer.resize(64*1024);
+        ssize_t transfered = pipe_read(input, &buffer[0], std::min(size, buffer.size()));
+        if (transfered <= 0)
+            return transfered;
+        if (pipe_write_all(output, &buffer[0], transfered) < (std::size_t)transfered)
+            return -1;
+        return transfered;
+    }
+
+    ssize_t pipe_splice(PipeHandle input, PipeHandle output, std::size_t size) {
+#ifdef __linux__
+        ssize_t transfered = splice(input, nullptr, output, nullptr, size, SPLICE_F_MOVE);
+        // EINVAL when neither is a pipe
+        if (transfered >= 0 || errno != EINVAL)
+            return transfered;
 #endif
+        std::vector<char> buffer;
+        return copy_some(input, output, size, buffer);
+    }
+
+    std::size_t pipe_splice_all(PipeHandle input, PipeHandle output, std::size_t max) {
+        std::size_t total = 0;
+        std::vector<char> buffer;
+#ifdef __linux__
+        bool use_splice = true;
+#endif
+        while (total < max) {
+            // splice() moves at most what the pipes hold anyway
+            std::size_t size = std::min<std::size_t>(max - total, 1 << 30);
+            ssize_t transfered;
+#ifdef __linux__
+            if (use_splice) {
+                transfered = splice(input, nullptr, output, nullptr, size, SPLICE_F_MOVE);
+                if (transfered < 0 && errno == EINVAL) {
+                    use_splice = false;
+                    continue;
+                }
+            } else
+#endif
+            transfered = copy_some(input, output, size, buffer);
+            if (transfered < 0) {
+#ifndef _WIN32
+                if (errno == EINTR)
+                    continue;
+#endif
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // either side may be the one that's not ready
+                    PipePoll entry = {input, kPipeReadable};
+                    pipe_poll(&entry, 1);
+                    entry = {output, kPipeWritable};
+                    pipe_poll(&entry, 1);
+                    continue;
+                }
+                break;
+            }
+            if (transfered == 0)
+                break;
+            total += transfered;
+        }
+        return total;
+    }
 
     std::string pipe_read_all(PipeHandle handle) {
         if (handle == kBadPipeValue)
             return {};
-        constexpr int buf_size = 2048;
-        uint8_t buf[buf_size];
-        std::string result;
-        while(true) {
-            ssize_t transfered = pipe_read(handle, buf, buf_size);
-            if(transfered > 0) {
-                result.insert(result.end(), &buf[0], &buf[transfered]);
-            } else {
+        /*  Reads fill uninitialized chunks growing up to 4MB, joined once at
+            the end. Nothing is zeroed first and every byte is copied once
+            after the read, where growing a string copies it again on each
+            reallocation. Near the end of a chunk the read spans into the
+            next one.
+        */
+        struct Chunk {
+            std::unique_ptr<char[]> data;
+            std::size_t             capacity;
+            std::size_t             used;
+        };
+        std::vector<Chunk> chunks;
+        std::size_t next_size = 64*1024;
+        auto add_chunk = [&]() {
+            chunks.push_back({std::unique_ptr<char[]>(new char[next_size]), next_size, 0});
+            next_size = std::min<std::size_t>(next_size*2, 4*1024*1024);
+        };
+        add_chunk();
+        std::size_t total = 0;
+        while (true) {
+            std::size_t current = chunks.size() - 1;
+            if (chunks[current].capacity - chunks[current].used < 16*1024)
+                add_chunk();
+            PipeBuffer buffers[2];
+            std::size_t count = 0;
+            for (std::size_t i = current; i < chunks.size(); ++i) {
+                Chunk& chunk = chunks[i];
+                if (chunk.used < chunk.capacity)
+                    buffers[count++] = PipeBuffer(chunk.data.get() + chunk.used,
+                        chunk.capacity - chunk.used);
+            }
+            ssize_t transfered = pipe_readv(handle, buffers, count);
+#ifndef _WIN32
+            if (transfered < 0 && errno == EINTR)
+                continue;
+#endif
+            if (transfered < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                PipePoll entry = {handle, kPipeReadable};
+                pipe_poll(&entry, 1);
+                continue;
+            }
+            if (transfered <= 0)
                 break;
+            total += transfered;
+            for (std::size_t i = current; i < chunks.size() && transfered > 0; ++i) {
+                Chunk& chunk = chunks[i];
+                std::size_t size = std::min<std::size_t>(transfered, chunk.capacity - chunk.used);
+                chunk.used += size;
+                transfered -= size;
             }
         }
+        std::string result;
+        result.reserve(total);
+        for (auto& chunk : chunks)
+            result.append(chunk.data.get(), chunk.used);
         return result;
     }
 
@@ -143,7 +576,15 @@ namespace subprocess {
             return;
         std::thread thread([handle]() {
             std::vector<uint8_t> buffer(1024);
-            while(pipe_read(handle, &buffer[0], buffer.size()) >= 0){
+            while (true) {
+                ssize_t transfered = pipe_read(handle, &buffer[0], buffer.size());
+#ifndef _WIN32
+                if (transfered < 0 && errno == EINTR)
+                    continue;
+#endif
+                // 0 is the end
+                if (transfered <= 0)
+                    break;
             }
             pipe_close(handle);
         });
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string_view>
+
 #include "basic_types.hpp"
 
 namespace subprocess {
@@ -58,6 +60,32 @@ namespace subprocess {
         @param inheritable if true handle will be inherited in subprocess.
     */
     void pipe_set_inheritable(PipeHandle handle, bool inheritable);
+    /** Puts the pipe in non-blocking mode, or back to blocking. In
+        non-blocking mode pipe_read/pipe_write return -1 with errno EAGAIN
+        instead of waiting. On windows this is PIPE_NOWAIT.
+
+        @throw OSError if system call fails.
+    */
+    void pipe_set_nonblocking(PipeHandle handle, bool nonblocking = true);
+    /** Creates a connected pair of stream sockets, socketpair(AF_UNIX,
+        SOCK_STREAM). Unlike with a pipe both ends read & write, and
+        pipe_read/pipe_write work on them.
+
+        @param inheritable  if true subprocesses will inherit the sockets.
+
+        @throw OSError if system call fails.
+        @throw std::domain_error on windows.
+    */
+    PipePair socket_create(bool inheritable = true);
+    /** Sets SO_SNDBUF & SO_RCVBUF of a socket. 0 leaves it unchanged.
+
+        @throw OSError if system call fails.
+    */
+    void socket_set_buffers(PipeHandle handle, int send, int receive);
+    /** Shuts down sending on a socket. The other end reads end of file while
+        this end can still read.
+    */
+    void socket_shutdown_write(PipeHandle handle);
 
     /**
         @returns    -1 on error. if 0 it could be the end, or perhaps wait for
@@ -69,13 +97,135 @@ namespace subprocess {
                     more data.
     */
     ssize_t pipe_write(PipeHandle, const void* buffer, size_t size);
+    /** One buffer of a vectored read or write. Same layout as iovec so it
+        is passed to the system as is.
+    */
+    struct PipeBuffer {
+        PipeBuffer(){}
+        PipeBuffer(void* data, std::size_t size) : data(data), size(size) {}
+        /** For writing only */
+        PipeBuffer(const void* data, std::size_t size) : data(const_cast<void*>(data)), size(size) {}
+        /** For writing only */
+        PipeBuffer(std::string_view data) : PipeBuffer(data.data(), data.size()) {}
+
+        void*       data = nullptr;
+        std::size_t size = 0;
+    };
+    /** Writes the buffers in order, in one system call on posix.
+
+        @returns    bytes written which may be less than all of them, -1 on
+                    error.
+    */
+    ssize_t pipe_writev(PipeHandle handle, const PipeBuffer* buffers, std::size_t count);
+    /** Reads into the buffers in order, in one system call on posix.
+
+        @returns    bytes read, 0 at the end, -1 on error.
+    */
+    ssize_t pipe_readv(PipeHandle handle, const PipeBuffer* buffers, std::size_t count);
+    /** Writes all of data, continuing after partial writes and interrupted
+        calls. Works for non-blocking handles too, waiting for room.
+
+        @returns    bytes written, less than size if the pipe failed, e.g. the
+                    reader closed it.
+    */
+    std::size_t pipe_write_all(PipeHandle handle, const void* data, std::size_t size);
+    /** Vectored pipe_write_all(). buffers are advanced past what has been
+        written as it goes.
+
+        @returns    bytes written, less than the total if the pipe failed.
+    */
+    std::size_t pipe_writev_all(PipeHandle handle, PipeBuffer* buffers, std::size_t count);
+    /** Moves up to size bytes from input to output. On linux with splice()
+        when either is a pipe, the data never passes through user space.
+        Otherwise it's read into a buffer and written with pipe_write_all().
+        Blocks until something was moved.
+
+        @returns    bytes moved, 0 at the end of input, -1 on error, e.g.
+                    EPIPE when output's reader is gone.
+    */
+    ssize_t pipe_splice(PipeHandle input, PipeHandle output, std::size_t size);
+    /** pipe_splice() until the end of input or max bytes. Works for
+        non-blocking handles too, waiting on them.
+
+        @returns    bytes moved, fewer than max and the end of input if
+                    output failed.
+    */
+    std::size_t pipe_splice_all(PipeHandle input, PipeHandle output,
+        std::size_t max = (std::size_t)-1);
+    /** pipe_writev() that never blocks, whether or not the handle is in
+        non-blocking mode. On linux it's pwritev2(RWF_NOWAIT), where that is
+        unsupported at most PIPE_BUF bytes are written once poll() says
+        there is room.
+
+        @returns    bytes written, -1 with errno EAGAIN if the pipe is full.
+
+        @throw std::domain_error on windows.
+    */
+    ssize_t pipe_try_writev(PipeHandle handle, const PipeBuffer* buffers, std::size_t count);
+    /** pipe_readv() that never blocks, whether or not the handle is in
+        non-blocking mode.
+
+        @returns    bytes read, 0 at the end, -1 with errno EAGAIN if nothing
+                    is available.
+    */
+    ssize_t pipe_try_readv(PipeHandle handle, const PipeBuffer* buffers, std::size_t count);
+    /** pipe_read() that never blocks.
+
+        @returns    bytes read, 0 at the end, -1 with errno EAGAIN if nothing
+                    is available yet.
+    */
+    ssize_t pipe_try_read(PipeHandle handle, void* buffer, std::size_t size);
+    /** pipe_write() that never blocks.
+
+        @returns    bytes written, -1 with errno EAGAIN if the pipe is full.
+
+        @throw std::domain_error on windows.
+    */
+    ssize_t pipe_try_write(PipeHandle handle, const void* buffer, std::size_t size);
+
+    enum PipeEvent {
+        /** Data to read, or the end which reads 0. */
+        kPipeReadable   = 1,
+        /** Room to write. */
+        kPipeWritable   = 2,
+        /** The other end is closed or the handle failed. A reader still
+            reads what's left before the end.
+        */
+        kPipeClosed     = 4
+    };
+    /** A handle to wait on in pipe_poll(). */
+    struct PipePoll {
+        PipeHandle  handle  = kBadPipeValue;
+        /** PipeEvent flags to wait for. kPipeClosed is always reported. */
+        int         events  = kPipeReadable;
+        /** Set by pipe_poll() to the PipeEvent flags that happened. */
+        int         ready   = 0;
+    };
+    /** Waits until one of the handles is ready or deadline is reached.
+
+        Entries with kBadPipeValue are skipped, so a set of pipes can be
+        polled in place as they close.
+
+        @param deadline a monotonic_seconds() time. Negative waits forever,
+                        one already past only checks.
+
+        @returns    number of entries with ready set, 0 if deadline was
+                    reached.
+
+        @throw OSError if system call fails.
+
+        On windows there is no readiness for anonymous pipes, readable is
+        checked with PeekNamedPipe every millisecond and writable is always
+        reported.
+    */
+    int pipe_poll(PipePoll* entries, std::size_t count, double deadline = -1);
     /** Spawns a thread to read from the pipe. When no more data available
         pipe will be closed.
     */
     void pipe_ignore_and_close(PipeHandle handle);
     /** Read contents of handle until no more data is available.
 
-        If the pipe is non-blocking this will end prematurely.
+        A non-blocking pipe is waited on with pipe_poll() when empty.
 
         @return all data read from pipe as a string object. This works fine
                 with binary data.
@@ -0,0 +1,139 @@
+#include "simd.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SUBPROCESS_X86 1
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SUBPROCESS_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <immintrin.h>
+#define SUBPROCESS_AVX2 1
+#define SUBPROCESS_TARGET_AVX2
+#elif defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define SUBPROCESS_AVX2 1
+// compiled for avx2 regardless of -m flags, only called if the cpu has it
+#define SUBPROCESS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    using subprocess::details::SimdLevel;
+
+    inline unsigned count_trailing_zeros(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    const char* find_byte_scalar(const char* begin, const char* end, char byte) {
+        const void* found = std::memchr(begin, byte, end - begin);
+        return found? (const char*)found : end;
+    }
+
+#ifdef SUBPROCESS_SSE2
+    const char* find_byte_sse2(const char* begin, const char* end, char byte) {
+        const __m128i needle = _mm_set1_epi8(byte);
+        const char* pos = begin;
+        for (; end - pos >= 16; pos += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)pos);
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+            if (mask)
+                return pos + count_trailing_zeros(mask);
+        }
+        return find_byte_scalar(pos, end, byte);
+    }
+#endif
+
+#ifdef SUBPROCESS_AVX2
+    SUBPROCESS_TARGET_AVX2
+    const char* find_byte_avx2(const char* begin, const char* end, char byte) {
+        const __m256i needle = _mm256_set1_epi8(byte);
+        const char* pos = begin;
+        // 2 blocks per iteration, lines are often longer than 32 bytes
+        for (; end - pos >= 64; pos += 64) {
+            __m256i block0 = _mm256_loadu_si256((const __m256i*)pos);
+            __m256i block1 = _mm256_loadu_si256((const __m256i*)(pos + 32));
+            unsigned mask0 = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block0, needle));
+            unsigned mask1 = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block1, needle));
+            if (mask0)
+                return pos + count_trailing_zeros(mask0);
+            if (mask1)
+                return pos + 32 + count_trailing_zeros(mask1);
+        }
+        for (; end - pos >= 32; pos += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i*)pos);
+            unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+            if (mask)
+                return pos + count_trailing_zeros(mask);
+        }
+        return find_byte_scalar(pos, end, byte);
+    }
+
+    bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuidex(info, 1, 0);
+        // osxsave & avx, the OS has to save the ymm registers
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+            return false;
+        if ((_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    SimdLevel detect_simd_level() {
+#ifdef SUBPROCESS_AVX2
+        if (cpu_has_avx2())
+            return SimdLevel::avx2;
+#endif
+#ifdef SUBPROCESS_SSE2
+        return SimdLevel::sse2;
+#else
+        return SimdLevel::scalar;
+#endif
+    }
+}
+
+namespace subprocess {
+    namespace details {
+        SimdLevel simd_level() {
+            static const SimdLevel level = detect_simd_level();
+            return level;
+        }
+
+        const char* find_byte(const char* begin, const char* end, char byte, SimdLevel level) {
+            if (level > simd_level())
+                level = simd_level();
+            switch (level) {
+#ifdef SUBPROCESS_AVX2
+            case SimdLevel::avx2:   return find_byte_avx2(begin, end, byte);
+#endif
+#ifdef SUBPROCESS_SSE2
+            case SimdLevel::sse2:   return find_byte_sse2(begin, end, byte);
+#endif
+            default:                return find_byte_scalar(begin, end, byte);
+            }
+        }
+
+        const char* find_byte(const char* begin, const char* end, char byte) {
+            return find_byte(begin, end, byte, simd_level());
+        }
+    }
+}
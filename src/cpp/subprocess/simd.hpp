@@ -0,0 +1,28 @@
+/** @cond PRIVATE */
+#pragma once
+
+#include <cstddef>
+
+// vectorized helpers for the hot loops processing child output
+namespace subprocess {
+    namespace details {
+        /** Which implementation find_byte() dispatches to on this cpu. */
+        enum class SimdLevel {
+            scalar,
+            sse2,
+            avx2
+        };
+        SimdLevel simd_level();
+
+        /** @return pointer to first occurrence of byte in [begin, end) or
+                    end if not found.
+        */
+        const char* find_byte(const char* begin, const char* end, char byte);
+        /** Same as find_byte() but forces a specific implementation. Used by
+            tests and benchmarks. Falls back to a lower level if the cpu or
+            compiler doesn't support it.
+        */
+        const char* find_byte(const char* begin, const char* end, char byte, SimdLevel level);
+    }
+}
+/** @endcond */
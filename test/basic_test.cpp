@@ -6,6 +6,7 @@
 #include "test_config.h"
 
 #include <subprocess/utf8_to_utf16.hpp>
+#include <subprocess/simd.hpp>
 
 #include "monolithic_examples.h"
 
@@ -390,6 +391,1052 @@ public:
     }
 
 
+    void testPinnedCin() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 100000; ++i)
+            data += std::to_string(i) + "\n";
+        subprocess::PinnedBuffer pinned(data);
+        TS_ASSERT_EQUALS(pinned.size(), data.size());
+
+        auto completed = subprocess::run({"cat"},
+            RunBuilder().cin(pinned).cout(PipeOption::pipe));
+        TS_ASSERT_EQUALS(completed.cout, data);
+
+        completed = subprocess::run({"cat"},
+            RunBuilder().cin(subprocess::PinnedBuffer()).cout(PipeOption::pipe));
+        TS_ASSERT_EQUALS(completed.cout, "");
+
+        // no SIGPIPE when the child doesn't read it all
+        completed = subprocess::run({"true"}, RunBuilder().cin(pinned));
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        subprocess::sleep_seconds(0.2);
+    }
+
+    void testFileRedirect() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+        using subprocess::FileMode;
+        using subprocess::FileRedirect;
+
+        std::string path = std::string(TEST_BINARY_DIR) + "/redirect_test.txt";
+        auto completed = RunBuilder({"echo", "hello"})
+            .cout(FileRedirect{path, FileMode::truncate}).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        completed = RunBuilder({"echo", "world"})
+            .cout(FileRedirect{path, FileMode::append}).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+
+        completed = RunBuilder({"cat"}).cin(FileRedirect{path, FileMode::read})
+            .cout(PipeOption::pipe).run();
+        TS_ASSERT_EQUALS(completed.cout, "hello" EOL "world" EOL);
+
+        completed = RunBuilder({"echo", "hello"}).cout(PipeOption::devnull).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        TS_ASSERT(completed.cout.empty());
+        completed = RunBuilder({"cat"}).cin(PipeOption::devnull)
+            .cout(PipeOption::pipe).run();
+        TS_ASSERT_EQUALS(completed.cout, "");
+
+        TS_ASSERT_THROWS(RunBuilder({"cat"}).cin(FileRedirect{path + ".missing", FileMode::read}).run(),
+            subprocess::SpawnError);
+        std::remove(path.c_str());
+    }
+
+    void testChunkCallback() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 100000; ++i)
+            data += std::to_string(i) + "\n";
+        std::string received;
+        int chunks = 0;
+        auto completed = RunBuilder({"cat"}).cin(data)
+            .cout([&](std::string_view chunk) {
+                received.append(chunk.data(), chunk.size());
+                ++chunks;
+            }).run();
+        TS_ASSERT_EQUALS(received, data);
+        TS_ASSERT(chunks > 1);
+        TS_ASSERT(completed.cout.empty());
+
+        struct CountingSink : subprocess::OutputSink {
+            std::size_t size = 0;
+            bool finished = false;
+            void write(std::string_view chunk) override { size += chunk.size(); }
+            void finish() override { finished = true; }
+        };
+        auto sink = std::make_shared<CountingSink>();
+        completed = RunBuilder({"cat"}).cin(data).cout(sink).run();
+        TS_ASSERT_EQUALS(sink->size, data.size());
+        TS_ASSERT(sink->finished);
+
+        TS_ASSERT_THROWS(RunBuilder({"echo", "hello"})
+            .cout([](std::string_view) { throw std::runtime_error("sink"); }).run(),
+            std::runtime_error);
+    }
+
+    void testLineSink() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        std::vector<std::string> expected;
+        for (int i = 0; i < 20000; ++i) {
+            expected.push_back(std::string(i % 150, 'a' + i % 26) + std::to_string(i));
+            data += expected.back() + "\n";
+        }
+        expected.push_back("no newline");
+        data += expected.back();
+
+        std::vector<std::string> lines;
+        auto sink = std::make_shared<subprocess::LineSink>([&](std::string_view line) {
+            lines.emplace_back(line);
+        });
+        // odd chunk sizes so lines get split everywhere
+        for (std::size_t pos = 0, step = 1; pos < data.size(); pos += step, step = step*7 % 263 + 1)
+            sink->write(std::string_view(data).substr(pos, step));
+        sink->finish();
+        TS_ASSERT_EQUALS(lines, expected);
+
+        lines.clear();
+        RunBuilder({"cat"}).cin(data).cout(std::make_shared<subprocess::LineSink>(
+            [&](std::string_view line) { lines.emplace_back(line); })).run();
+        TS_ASSERT_EQUALS(lines, expected);
+
+        using subprocess::details::SimdLevel;
+        for (SimdLevel level : {SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2}) {
+            for (std::size_t size = 0; size < 200; ++size) {
+                std::string haystack(size, 'x');
+                for (std::size_t at = 0; at <= size; ++at) {
+                    if (at < size)
+                        haystack[at] = '\n';
+                    const char* found = subprocess::details::find_byte(haystack.data(),
+                        haystack.data() + size, '\n', level);
+                    TS_ASSERT_EQUALS(found - haystack.data(), (std::ptrdiff_t)at);
+                    if (at < size)
+                        haystack[at] = 'x';
+                }
+            }
+        }
+    }
+
+    void testTailCapture() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 100000; ++i)
+            data += std::to_string(i) + "\n";
+
+        auto completed = RunBuilder({"cat", "--output-stderr"}).cin(data)
+            .cerr(std::make_shared<subprocess::TailCapture>(1000, 10)).run();
+        TS_ASSERT_EQUALS(completed.cerr, data.substr(0, 10) + data.substr(data.size() - 1000));
+        TS_ASSERT_EQUALS(completed.cerr_dropped, data.size() - 1010);
+
+        // nothing dropped when it all fits
+        subprocess::TailCapture tail(100, 5);
+        tail.write("hello");
+        tail.write(" world");
+        TS_ASSERT_EQUALS(tail.str(), "hello world");
+        TS_ASSERT_EQUALS(tail.dropped(), 0);
+
+        // wrapping around the ring in small writes
+        subprocess::TailCapture ring(7);
+        std::string written;
+        for (int i = 0; i < 50; ++i) {
+            std::string piece = std::to_string(i * 37);
+            ring.write(piece);
+            written += piece;
+            std::size_t keep = std::min<std::size_t>(7, written.size());
+            TS_ASSERT_EQUALS(ring.str(), written.substr(written.size() - keep));
+            TS_ASSERT_EQUALS(ring.dropped(), written.size() - keep);
+        }
+
+        // printenv without arguments prints usage and fails
+        try {
+            RunBuilder({"printenv"}).check(true)
+                .cout(std::make_shared<subprocess::TailCapture>(20)).run();
+            TS_ASSERT(false);
+        } catch (subprocess::CalledProcessError& error) {
+            TS_ASSERT_EQUALS(error.cout.size(), 20);
+            TS_ASSERT(error.cout_dropped > 0);
+        }
+    }
+
+    void testSpillCapture() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 100000; ++i)
+            data += std::to_string(i) + "\n";
+
+        auto spill = std::make_shared<subprocess::SpillCapture>(1000);
+        auto completed = RunBuilder({"cat"}).cin(data).cout(spill).run();
+        TS_ASSERT(completed.cout.empty());
+        TS_ASSERT(spill->spilled());
+        TS_ASSERT_EQUALS(spill->size(), data.size());
+        TS_ASSERT(spill->view() == data);
+
+        std::string read_back;
+        auto reader = spill->reader();
+        char buffer[333];
+        while (std::size_t transfered = reader.read(buffer, sizeof(buffer)))
+            read_back.append(buffer, transfered);
+        TS_ASSERT_EQUALS(read_back, data);
+
+        auto small = std::make_shared<subprocess::SpillCapture>(1000);
+        RunBuilder({"echo", "hello"}).cout(small).run();
+        TS_ASSERT(!small->spilled());
+        TS_ASSERT(small->view() == "hello" EOL);
+    }
+
+    void testMemoryCapture() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 100000; ++i)
+            data += std::to_string(i) + "\n";
+
+        auto capture = std::make_shared<subprocess::MemoryCapture>();
+        auto completed = RunBuilder({"cat"}).cin(data).cout(capture).run();
+        TS_ASSERT(completed.cout.empty());
+        TS_ASSERT_EQUALS(capture->size(), data.size());
+        TS_ASSERT(capture->view() == data);
+
+        // the same capture appends
+        RunBuilder({"echo", "hello"}).cout(capture).run();
+        TS_ASSERT(capture->view() == data + "hello" EOL);
+
+        TS_ASSERT_THROWS(RunBuilder({"cat"}).cin(capture).run(), std::domain_error);
+    }
+
+    void testAppendCapture() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string cout;
+        std::string cerr;
+        for (int i = 0; i < 3; ++i) {
+            auto completed = subprocess::run({"echo", "hello"}, cout, cerr);
+            TS_ASSERT(completed.cout.empty());
+        }
+        TS_ASSERT_EQUALS(cout, "hello" EOL "hello" EOL "hello" EOL);
+        TS_ASSERT(cerr.empty());
+
+        cout.clear();
+        std::size_t capacity = cout.capacity();
+        subprocess::run({"echo", "again"}, cout, cerr);
+        TS_ASSERT_EQUALS(cout, "again" EOL);
+        TS_ASSERT_EQUALS(cout.capacity(), capacity);
+
+        // cerr into the same buffer
+        cout.clear();
+        subprocess::cenv["USE_CERR"] = "1";
+        subprocess::run({"echo", "merged"}, cout, cout);
+        TS_ASSERT_EQUALS(cout, "merged" EOL);
+    }
+
+    void testBroadcast() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 200000; ++i)
+            data += std::to_string(i) + "\n";
+
+        // from memory, echo doesn't read its cin and gets dropped
+        auto broadcast = std::make_shared<subprocess::Broadcast>(data);
+        std::vector<subprocess::Popen> children;
+        for (int i = 0; i < 3; ++i)
+            children.push_back(RunBuilder({"cat"}).cin(broadcast).cout(PipeOption::pipe).popen());
+        children.push_back(RunBuilder({"echo", "early"}).cin(broadcast).cout(PipeOption::pipe).popen());
+        broadcast->start();
+        for (int i = 0; i < 3; ++i)
+            TS_ASSERT_EQUALS(subprocess::run(children[i]).cout, data);
+        TS_ASSERT_EQUALS(subprocess::run(children[3]).cout, "early" EOL);
+        broadcast->wait();
+
+        /*  from another process's output. The children advance together so
+            their output must not back up, MemoryCapture never blocks.
+        */
+        auto producer = RunBuilder({"cat"}).cin(data).cout(PipeOption::pipe).popen();
+        auto teed = std::make_shared<subprocess::Broadcast>(producer.cout);
+        std::vector<std::shared_ptr<subprocess::MemoryCapture>> outputs;
+        children.clear();
+        for (int i = 0; i < 3; ++i) {
+            outputs.push_back(std::make_shared<subprocess::MemoryCapture>());
+            children.push_back(RunBuilder({"cat"}).cin(teed).cout(outputs.back()).popen());
+        }
+        teed->start();
+        teed->wait();
+        for (int i = 0; i < 3; ++i) {
+            children[i].wait();
+            TS_ASSERT(outputs[i]->view() == data);
+        }
+        producer.close();
+    }
+
+    void testSharder() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string data;
+        for (int i = 0; i < 100000; ++i)
+            data += std::to_string(i) + "\n";
+        auto sorted_lines = [](const std::string& text) {
+            std::vector<std::string> lines;
+            std::istringstream stream(text);
+            std::string line;
+            while (std::getline(stream, line))
+                lines.push_back(line);
+            std::sort(lines.begin(), lines.end());
+            return lines;
+        };
+
+        subprocess::ShardOptions options;
+        options.workers     = 4;
+        options.batch_size  = 1000;
+        auto completed = subprocess::run_sharded({"cat"}, data, options);
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        TS_ASSERT(sorted_lines(completed.cout) == sorted_lines(data));
+
+        options.ordered = true;
+        TS_ASSERT_EQUALS(subprocess::run_sharded({"cat"}, data, options).cout, data);
+        options.order = subprocess::ShardOrder::least_loaded;
+        TS_ASSERT_EQUALS(subprocess::run_sharded({"cat"}, data, options).cout, data);
+
+        // records split across writes, last one without a newline
+        subprocess::Sharder sharder({"cat"}, options);
+        sharder.write("first\nsec");
+        sharder.write("ond\nthird");
+        TS_ASSERT_EQUALS(sharder.finish().cout, "first\nsecond\nthird");
+    }
+
+    void testMergedOutput() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        std::string expected = RunBuilder({"stdioblaster", "100000"})
+            .cout(PipeOption::pipe).run().cout;
+        TS_ASSERT_EQUALS(expected.size(), 100000u);
+        // the final partial line gets a newline
+        expected += "\n";
+
+        const int children = 20;
+        std::ostringstream stream;
+        {
+            subprocess::MergedOutput merged(stream);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < children; ++i) {
+                auto sink = merged.sink(std::to_string(i) + " | ");
+                threads.emplace_back([sink]() {
+                    RunBuilder({"stdioblaster", "100000"}).cout(sink).run();
+                });
+            }
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        // every line must be whole, so demultiplexing gives back each output
+        std::vector<std::string> outputs(children);
+        std::istringstream lines(stream.str());
+        std::string line;
+        while (std::getline(lines, line)) {
+            auto separator = line.find(" | ");
+            TS_ASSERT(separator != std::string::npos);
+            int child = std::stoi(line.substr(0, separator));
+            outputs[child] += line.substr(separator + 3) + "\n";
+        }
+        for (auto& output : outputs)
+            TS_ASSERT(output == expected);
+    }
+
+    void testInterleavedCapture() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        using Stream = subprocess::InterleavedCapture::Stream;
+        subprocess::InterleavedCapture capture;
+        RunBuilder({"stdioblaster", "--interleave", "10"})
+            .cout(capture.cout()).cerr(capture.cerr()).run();
+
+        std::string expected;
+        for (int i = 0; i < 10; ++i)
+            expected += std::string(i % 2? "cerr " : "cout ") + std::to_string(i) + EOL;
+        TS_ASSERT_EQUALS(capture.data(), expected);
+
+        auto& chunks = capture.chunks();
+        TS_ASSERT_EQUALS(chunks.size(), 10u);
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            TS_ASSERT(chunks[i].stream == (i % 2? Stream::cerr : Stream::cout));
+            TS_ASSERT(capture.view(chunks[i]).substr(0, 4) == (i % 2? "cerr" : "cout"));
+            if (i > 0)
+                TS_ASSERT(chunks[i].time >= chunks[i-1].time);
+        }
+        TS_ASSERT_EQUALS(capture.str(Stream::cout),
+            "cout 0" EOL "cout 2" EOL "cout 4" EOL "cout 6" EOL "cout 8" EOL);
+        std::size_t cerr_size = 0;
+        capture.for_each(Stream::cerr, [&](std::string_view chunk) {
+            cerr_size += chunk.size();
+        });
+        TS_ASSERT_EQUALS(cerr_size, 5*(6 + strlen(EOL)));
+    }
+
+    void testStopOnMatch() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        // without stopping this takes 2 seconds
+        subprocess::StopWatch watch;
+        CompletedProcess completed = RunBuilder({"stdioblaster", "--interleave", "400"})
+            .cout(PipeOption::pipe).cerr(PipeOption::pipe)
+            .stop_on({"never printed", "cerr 11" EOL, "cout 12"}).check(true).run();
+        TS_ASSERT_LESS_THAN(watch.seconds(), 1.0);
+        TS_ASSERT_EQUALS(completed.matched, 1);
+        TS_ASSERT_DIFFERS(completed.returncode, 0);
+        std::string cerr = completed.cerr;
+        TS_ASSERT_LESS_THAN_EQUALS(strlen("cerr 11" EOL), cerr.size());
+        TS_ASSERT_EQUALS(cerr.substr(cerr.size() - strlen("cerr 11" EOL)), "cerr 11" EOL);
+        TS_ASSERT_EQUALS(completed.cout.find("cout 12"), std::string::npos);
+
+        // only cout piped, read by a thread, pattern spanning chunks
+        std::vector<std::string> chunks;
+        completed = RunBuilder({"stdioblaster", "--interleave", "400"})
+            .cout([&](std::string_view chunk) { chunks.emplace_back(chunk); })
+            .cerr(PipeOption::devnull).stop_on({"4" EOL "cout 6"}).run();
+        TS_ASSERT_EQUALS(completed.matched, 0);
+        std::string cout;
+        for (auto& chunk : chunks)
+            cout += chunk;
+        TS_ASSERT_EQUALS(cout, "cout 0" EOL "cout 2" EOL "cout 4" EOL "cout 6");
+
+        // ran to completion
+        completed = RunBuilder({"stdioblaster", "--interleave", "4"})
+            .cout(PipeOption::pipe).cerr(PipeOption::devnull).stop_on({"cout 3"}).run();
+        TS_ASSERT_EQUALS(completed.matched, -1);
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+
+        TS_ASSERT_THROWS(RunBuilder({"stdioblaster"}).stop_on({""}).run(),
+            std::invalid_argument);
+    }
+
+    void testExpect() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        subprocess::Expect session({"cat"});
+        session.send("hello\n");
+        auto match = session.expect({"world", "hello"}, 5);
+        TS_ASSERT_EQUALS(match.index, 1);
+        TS_ASSERT_EQUALS(match.before, "");
+        TS_ASSERT_EQUALS(match.match, "hello");
+
+        session.send("abc prompt> def");
+        match = session.expect({"prompt> "}, 5);
+        TS_ASSERT_EQUALS(match.index, 0);
+        TS_ASSERT_EQUALS(match.before, "\nabc ");
+
+        // the scan resumes after a timeout, the match spans both sends
+        TS_ASSERT_THROWS(session.expect({"defghi"}, 0.05), subprocess::TimeoutExpired);
+        session.send("ghi\n");
+        match = session.expect({"defghi"}, 5);
+        TS_ASSERT_EQUALS(match.index, 0);
+        TS_ASSERT_EQUALS(match.before, "");
+
+        session.sendline("bye");
+        session.send_eof();
+        match = session.expect({});
+        TS_ASSERT_EQUALS(match.index, -1);
+        TS_ASSERT_EQUALS(match.before, "\nbye\n");
+        TS_ASSERT_EQUALS(session.popen().wait(), 0);
+
+        // no SIGPIPE for writing to a program that exited
+        subprocess::Expect exited({"true"});
+        exited.popen().wait();
+        TS_ASSERT_THROWS(exited.send("ignored\n"), subprocess::OSError);
+    }
+
+    void testPassFds() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+#ifdef _WIN32
+        auto pipe = subprocess::pipe_create(false);
+        TS_ASSERT_THROWS(RunBuilder({"stdioblaster"}).pass_fd(3, pipe.output).run(),
+            std::domain_error);
+#else
+        auto side = subprocess::pipe_create(false);
+        auto other = subprocess::pipe_create(false);
+        // swapped numbers, each handle is also the target of the other
+        int a = side.output;
+        int b = other.output;
+        CompletedProcess completed = RunBuilder({"stdioblaster", "--fd",
+            std::to_string(a), "to b"}).pass_fd(a, b).pass_fd(b, a).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        other.close_output();
+        TS_ASSERT_EQUALS(subprocess::pipe_read_all(other.input), "to b");
+
+        // an inheritable handle that is not passed is closed in the child
+        auto leaked = subprocess::pipe_create(true);
+        completed = RunBuilder({"stdioblaster", "--fd", std::to_string(leaked.output),
+            "leaked"}).pass_fd(a, a).run();
+        TS_ASSERT_EQUALS(completed.returncode, 1);
+        completed = RunBuilder({"stdioblaster", "--fd", std::to_string(a), "side"})
+            .pass_fd(a, a).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        side.close_output();
+        TS_ASSERT_EQUALS(subprocess::pipe_read_all(side.input), "side");
+
+        // with piped stdio and a specific handle, each closed only once
+        auto in = subprocess::pipe_create(true);
+        completed = RunBuilder({"stdioblaster", "--fd", "1", "piped"})
+            .pass_fd(a, a).cin(in.input).cout(PipeOption::pipe).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        TS_ASSERT_EQUALS(completed.cout, "piped");
+        in.close();
+
+        TS_ASSERT_THROWS(RunBuilder({"stdioblaster"}).pass_fd(2, a).run(),
+            std::invalid_argument);
+#endif
+    }
+
+    void testSocketpair() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+#ifdef _WIN32
+        TS_ASSERT_THROWS(RunBuilder({"cat"}).cout(PipeOption::socketpair).run(),
+            std::domain_error);
+#else
+        // one socket both ways, closing cin still ends the child's input
+        subprocess::Popen popen = RunBuilder({"cat"}).cin(PipeOption::socketpair)
+            .cout(PipeOption::socketpair).popen();
+        TS_ASSERT_DIFFERS(popen.cin, popen.cout);
+        std::string message = "hello socket";
+        TS_ASSERT_EQUALS(subprocess::pipe_write(popen.cin, message.data(), message.size()),
+            (ssize_t)message.size());
+        popen.close_cin();
+        TS_ASSERT_EQUALS(subprocess::pipe_read_all(popen.cout), message);
+        TS_ASSERT_EQUALS(popen.wait(), 0);
+
+        CompletedProcess completed = RunBuilder({"stdioblaster", "100000"})
+            .cout(PipeOption::socketpair).cerr(PipeOption::socketpair)
+            .socket_buffers(256*1024, 256*1024).run();
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+        TS_ASSERT_EQUALS(completed.cout.size(), 100000u);
+        TS_ASSERT_EQUALS(completed.cerr, "");
+#endif
+    }
+
+    void testShmChannel() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+#ifdef __linux__
+        // a small ring so both sides block and wrap around many times
+        subprocess::ShmChannel to_child(4096);
+        subprocess::ShmChannel from_child(4096);
+        TS_ASSERT_EQUALS(to_child.capacity() % 4096, 0u);
+        subprocess::RunOptions options;
+        to_child.pass_to(options, 3);
+        from_child.pass_to(options, 6);
+        subprocess::Popen popen({"ring_child"}, options);
+
+        std::string input;
+        for (int i = 0; input.size() < 1024*1024; ++i)
+            input += std::to_string(i) + ' ';
+        std::thread feeder([&]() {
+            auto writer = to_child.writer();
+            // odd sized writes straddle the end of the ring
+            for (std::size_t pos = 0; pos < input.size(); pos += 1000)
+                writer.write(std::string_view(input).substr(pos, 1000));
+        });
+        std::string output;
+        auto reader = from_child.reader();
+        char buffer[777];
+        while (std::size_t count = reader.read(buffer, sizeof(buffer)))
+            output.append(buffer, count);
+        feeder.join();
+        TS_ASSERT_EQUALS(popen.wait(), 0);
+        TS_ASSERT(output == input);
+#else
+        TS_ASSERT_THROWS(subprocess::ShmChannel(), std::domain_error);
+#endif
+    }
+
+    void testFramedChannel() {
+        subprocess::EnvGuard guard;
+        prepend_this_to_path();
+
+        // cat echoes the frames back as they are
+        subprocess::Popen cat = RunBuilder({"cat"}).cin(PipeOption::pipe)
+            .cout(PipeOption::pipe).popen();
+        subprocess::FramedChannel channel(cat);
+        std::vector<std::string> messages;
+        for (int i = 0; i < 5000; ++i)
+            messages.push_back(std::string(i % 300, (char)('a' + i % 26)));
+        messages.push_back("");
+        messages.push_back(std::string(200*1024, 'z'));
+        messages.push_back("last");
+
+        std::thread sender([&]() {
+            for (auto& message : messages)
+                channel.send(message);
+            channel.close();
+        });
+        std::size_t count = 0;
+        std::string_view reply;
+        while (channel.receive(reply)) {
+            if (count < messages.size())
+                TS_ASSERT(reply == messages[count]);
+            ++count;
+        }
+        sender.join();
+        TS_ASSERT_EQUALS(count, messages.size());
+        TS_ASSERT_EQUALS(cat.wait(), 0);
+
+        // a frame cut short
+        auto pipe = subprocess::pipe_create(false);
+        subprocess::FramedChannel broken(pipe.input, subprocess::kBadPipeValue);
+        subprocess::pipe_write(pipe.output, "\x05" "abc", 4);
+        pipe.close_output();
+        TS_ASSERT_THROWS(broken.receive(reply), std::runtime_error);
+
+        // a corrupt length doesn't allocate it
+        auto huge = subprocess::pipe_create(false);
+        subprocess::FramedChannel oversized(huge.input, subprocess::kBadPipeValue);
+        // 2^50
+        subprocess::pipe_write(huge.output, "\x80\x80\x80\x80\x80\x80\x80\x02", 8);
+        TS_ASSERT_THROWS(oversized.receive(reply), std::runtime_error);
+        oversized.max_message_size = 4;
+        subprocess::pipe_write(huge.output, "\x05" "abcde", 6);
+        huge.close_output();
+        TS_ASSERT_THROWS(oversized.receive(reply), std::runtime_error);
+
+        // no SIGPIPE for writing to a reader that's gone
+        auto orphan = subprocess::pipe_create(false);
+        orphan.close_input();
+        subprocess::FramedChannel unread(subprocess::kBadPipeValue, orphan.output);
+        unread.send("lost");
+        TS_ASSERT_THROWS(unread.flush(), subprocess::OSError);
+    }
+
+    void testVectoredIo() {
+        using subprocess::PipeBuffer;
+        auto pipe = subprocess::pipe_create(false);
+        PipeBuffer out[3] = {{"hello ", 6}, {std::string_view()}, {std::string_view("world")}};
+        TS_ASSERT_EQUALS(subprocess::pipe_writev(pipe.output, out, 3), 11);
+        char first[4], second[16];
+        PipeBuffer in[2] = {{first, sizeof(first)}, {second, sizeof(second)}};
+        TS_ASSERT_EQUALS(subprocess::pipe_readv(pipe.input, in, 2), 11);
+        TS_ASSERT_EQUALS(std::string(first, 4) + std::string(second, 7), "hello world");
+
+#ifndef _WIN32
+        // nothing to read
+        errno = 0;
+        TS_ASSERT_EQUALS(subprocess::pipe_try_readv(pipe.input, in, 2), -1);
+        TS_ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+
+        // fill the pipe until it would block
+        std::string block(4096, 'x');
+        std::size_t buffered = 0;
+        while (true) {
+            PipeBuffer buffer(block);
+            ssize_t transfered = subprocess::pipe_try_writev(pipe.output, &buffer, 1);
+            if (transfered < 0) {
+                TS_ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+                break;
+            }
+            buffered += transfered;
+        }
+        TS_ASSERT(buffered >= 4096);
+        while (buffered > 0) {
+            ssize_t transfered = subprocess::pipe_try_readv(pipe.input, in, 2);
+            TS_ASSERT(transfered > 0);
+            if (transfered <= 0)
+                break;
+            buffered -= transfered;
+        }
+#endif
+
+        // many buffers, bigger than the pipe holds, written while read
+        std::vector<std::string> parts;
+        for (int i = 0; i < 2000; ++i)
+            parts.push_back(std::string(i % 700 + 1, (char)('a' + i % 26)));
+        std::string expected;
+        std::vector<PipeBuffer> buffers;
+        for (auto& part : parts) {
+            expected += part;
+            buffers.emplace_back(part);
+        }
+        std::string received;
+        std::thread reader([&]() {
+            received = subprocess::pipe_read_all(pipe.input);
+        });
+        TS_ASSERT_EQUALS(subprocess::pipe_writev_all(pipe.output, buffers.data(),
+            buffers.size()), expected.size());
+        TS_ASSERT_EQUALS(subprocess::pipe_write_all(pipe.output, "end", 3), 3u);
+        pipe.close_output();
+        reader.join();
+        TS_ASSERT(received == expected + "end");
+        pipe.close();
+    }
+
+    void testNonBlockingPipes() {
+        using subprocess::PipePoll;
+        auto pipe = subprocess::pipe_create(false);
+        subprocess::pipe_set_nonblocking(pipe.input);
+        char buffer[64];
+        errno = 0;
+        TS_ASSERT_EQUALS(subprocess::pipe_read(pipe.input, buffer, sizeof(buffer)), -1);
+        TS_ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+        TS_ASSERT_EQUALS(subprocess::pipe_try_read(pipe.input, buffer, sizeof(buffer)), -1);
+
+        // nothing comes, the deadline passes
+        PipePoll entry = {pipe.input, subprocess::kPipeReadable};
+        subprocess::StopWatch watch;
+        TS_ASSERT_EQUALS(subprocess::pipe_poll(&entry, 1,
+            subprocess::monotonic_seconds() + 0.05), 0);
+        TS_ASSERT(watch.seconds() >= 0.04);
+        TS_ASSERT_EQUALS(entry.ready, 0);
+
+        TS_ASSERT_EQUALS(subprocess::pipe_try_write(pipe.output, "abc", 3), 3);
+        TS_ASSERT_EQUALS(subprocess::pipe_poll(&entry, 1, 0), 1);
+        TS_ASSERT_EQUALS(entry.ready, subprocess::kPipeReadable);
+        TS_ASSERT_EQUALS(subprocess::pipe_try_read(pipe.input, buffer, sizeof(buffer)), 3);
+        pipe.close_output();
+        TS_ASSERT_EQUALS(subprocess::pipe_poll(&entry, 1, 0), 1);
+        TS_ASSERT(entry.ready & subprocess::kPipeClosed);
+        TS_ASSERT_EQUALS(subprocess::pipe_try_read(pipe.input, buffer, sizeof(buffer)), 0);
+        pipe.close();
+
+        // one thread reading several processes
+        std::vector<subprocess::Popen> processes;
+        std::vector<PipePoll> entries;
+        for (int i = 0; i < 4; ++i) {
+            processes.push_back(RunBuilder({"echo", "process" + std::to_string(i)})
+                .cout(PipeOption::pipe).popen());
+            subprocess::pipe_set_nonblocking(processes.back().cout);
+            entries.push_back({processes.back().cout, subprocess::kPipeReadable});
+        }
+        std::vector<std::string> outputs(entries.size());
+        std::size_t open = entries.size();
+        while (open > 0) {
+            TS_ASSERT(subprocess::pipe_poll(&entries[0], entries.size(),
+                subprocess::monotonic_seconds() + 10) > 0);
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].ready == 0)
+                    continue;
+                ssize_t transfered = subprocess::pipe_try_read(entries[i].handle,
+                    buffer, sizeof(buffer));
+                if (transfered > 0) {
+                    outputs[i].append(buffer, transfered);
+                } else if (transfered == 0) {
+                    entries[i].handle = subprocess::kBadPipeValue;
+                    --open;
+                }
+            }
+        }
+        for (std::size_t i = 0; i < processes.size(); ++i) {
+            TS_ASSERT_EQUALS(processes[i].wait(), 0);
+            TS_ASSERT_EQUALS(outputs[i].substr(0, 8), "process" + std::to_string(i));
+        }
+    }
+
+    void testInputGenerator() {
+        // a million numbered lines made on demand
+        int next = 0;
+        std::size_t calls = 0;
+        subprocess::InputGenerator lines = [&](char* buffer, std::size_t size) {
+            ++calls;
+            std::size_t used = 0;
+            while (next < 1000000 && size - used >= 16)
+                used += std::snprintf(buffer + used, size - used, "%d\n", next++);
+            return used;
+        };
+        auto completed = RunBuilder({"cat"}).cin(lines)
+            .cout(PipeOption::pipe).run();
+        TS_ASSERT_EQUALS(next, 1000000);
+        TS_ASSERT(calls > 1);
+        std::size_t newlines = std::count(completed.cout.begin(), completed.cout.end(), '\n');
+        TS_ASSERT_EQUALS(newlines, 1000000u);
+        TS_ASSERT_EQUALS(completed.cout.substr(0, 8), "0\n1\n2\n3\n");
+
+        // backpressure, an endless generator stops when the child does
+        std::atomic<std::size_t> produced{0};
+        subprocess::InputGenerator endless = [&](char* buffer, std::size_t size) {
+            std::memset(buffer, 'x', size);
+            produced += size;
+            return size;
+        };
+        {
+            auto head = RunBuilder({"head", "-c", "1000"}).cin(endless)
+                .cout(PipeOption::pipe).run();
+            TS_ASSERT_EQUALS(head.cout.size(), 1000u);
+        }
+        // give the feeding thread time to notice
+        subprocess::sleep_seconds(0.2);
+        std::size_t total = produced;
+        subprocess::sleep_seconds(0.1);
+        TS_ASSERT_EQUALS(produced.load(), total);
+        // a pipe buffer and a couple of chunks at most
+        TS_ASSERT_LESS_THAN(total, 1024u*1024u);
+    }
+
+    void testFanOutSink() {
+        std::string input;
+        for (int i = 0; input.size() < 3*1024*1024; ++i)
+            input += "line " + std::to_string(i) + "\n";
+
+        // capture, a pipe (tee) and a file (write) and a callback at once
+        auto pipe = subprocess::pipe_create(false);
+        std::string piped;
+        std::thread reader([&]() { piped = subprocess::pipe_read_all(pipe.input); });
+        FILE* file = std::tmpfile();
+        std::size_t counted = 0;
+        auto fan = std::make_shared<subprocess::FanOutSink>();
+        fan->capture().add(pipe.output)
+            .add((subprocess::PipeHandle)fileno(file))
+            .add([&](std::string_view chunk) { counted += chunk.size(); });
+        auto completed = RunBuilder({"cat"}).cin(input).cout(fan).run();
+        pipe.close_output();
+        reader.join();
+        TS_ASSERT(completed.cout == input);
+        TS_ASSERT(piped == input);
+        TS_ASSERT_EQUALS(counted, input.size());
+        std::string written(input.size() + 1, '\0');
+        std::rewind(file);
+        written.resize(std::fread(&written[0], 1, written.size(), file));
+        std::fclose(file);
+        TS_ASSERT(written == input);
+
+        // without capture the first retaining sink fills CompletedProcess
+        auto tail = std::make_shared<subprocess::FanOutSink>();
+        tail->add(std::make_shared<subprocess::TailCapture>(10));
+        completed = RunBuilder({"cat"}).cin(input).cout(tail).run();
+        TS_ASSERT_EQUALS(completed.cout, input.substr(input.size() - 10));
+        TS_ASSERT_EQUALS(completed.cout_dropped, input.size() - 10);
+    }
+
+    void testOutputDigest() {
+        using subprocess::kDigestCrc32c;
+        using subprocess::kDigestXxh64;
+        TS_ASSERT_EQUALS(subprocess::crc32c("123456789"), 0xE3069283u);
+        TS_ASSERT_EQUALS(subprocess::details::crc32c("123456789", 9, 0, false), 0xE3069283u);
+        subprocess::Xxh64 empty;
+        TS_ASSERT_EQUALS(empty.digest(), 0xEF46DB3751D8E999ull);
+        subprocess::Xxh64 sentence;
+        sentence.update(std::string_view("Nobody inspects"));
+        sentence.update(std::string_view(" the spammish repetition"));
+        TS_ASSERT_EQUALS(sentence.digest(), 0xFBCEA83C8A378BF1ull);
+
+        std::string input;
+        for (int i = 0; input.size() < 2*1024*1024; ++i)
+            input += "record " + std::to_string(i) + "\n";
+        subprocess::Xxh64 expected_xxh64;
+        expected_xxh64.update(input);
+        const std::uint32_t expected_crc = subprocess::details::crc32c(
+            input.data(), input.size(), 0, false);
+
+        // captured
+        auto completed = RunBuilder({"cat"}).cin(input).cout(PipeOption::pipe)
+            .digest(kDigestCrc32c | kDigestXxh64).run();
+        TS_ASSERT(completed.cout == input);
+        TS_ASSERT_EQUALS(completed.cout_digest.kinds, kDigestCrc32c | kDigestXxh64);
+        TS_ASSERT_EQUALS(completed.cout_digest.crc32c, expected_crc);
+        TS_ASSERT_EQUALS(completed.cout_digest.xxh64, expected_xxh64.digest());
+        TS_ASSERT_EQUALS(completed.cout_digest.size, input.size());
+        TS_ASSERT_EQUALS(completed.cerr_digest.kinds, 0);
+
+        // discarded, read only to be digested
+        completed = RunBuilder({"cat"}).cin(input).cout(PipeOption::devnull)
+            .digest(kDigestXxh64).run();
+        TS_ASSERT(completed.cout.empty());
+        TS_ASSERT_EQUALS(completed.cout_digest.xxh64, expected_xxh64.digest());
+        TS_ASSERT_EQUALS(completed.cout_digest.size, input.size());
+
+        // through a sink, with cerr piped too
+        std::size_t lines = 0;
+        auto sink = std::make_shared<subprocess::LineSink>([&](std::string_view) { ++lines; });
+        completed = RunBuilder({"cat"}).cin(input).cout(sink).cerr(PipeOption::pipe)
+            .digest(kDigestCrc32c, kDigestCrc32c).run();
+        TS_ASSERT_EQUALS(completed.cout_digest.crc32c, expected_crc);
+        TS_ASSERT_EQUALS(completed.cerr_digest.crc32c, 0u);
+        TS_ASSERT_EQUALS(completed.cerr_digest.size, 0u);
+        TS_ASSERT(lines > 0);
+
+        // nothing for run() to read
+        TS_ASSERT_THROWS(RunBuilder({"cat"}).cin(input).digest(kDigestCrc32c).run(),
+            std::invalid_argument);
+    }
+
+    void testTransformStages() {
+        using subprocess::TransformStage;
+        // feeds input through stage in chunks of every size from 1 up
+        auto apply = [](TransformStage& stage, std::string input, std::size_t chunk) {
+            std::string output;
+            TransformStage::Emit emit = [&](char* data, std::size_t size) {
+                output.append(data, size);
+            };
+            for (std::size_t pos = 0; pos < input.size(); pos += chunk) {
+                std::size_t size = std::min(chunk, input.size() - pos);
+                stage.transform(&input[pos], size, emit);
+            }
+            stage.finish(emit);
+            return output;
+        };
+        for (std::size_t chunk = 1; chunk < 12; ++chunk) {
+            subprocess::CrlfToLf crlf;
+            TS_ASSERT_EQUALS(apply(crlf, "a\r\nb\rc\r\r\n\r", chunk), "a\nb\rc\r\n\r");
+            auto filter = subprocess::LineFilter::containing("keep");
+            TS_ASSERT_EQUALS(apply(*filter, "keep 1\ndrop\n\nkeep 2\nkeep", chunk),
+                "keep 1\nkeep 2\nkeep");
+            auto inverted = subprocess::LineFilter::containing("keep", true);
+            TS_ASSERT_EQUALS(apply(*inverted, "keep 1\ndrop\n\nkeep 2\nkeep", chunk),
+                "drop\n\n");
+        }
+
+        std::string log;
+        for (int i = 0; log.size() < 1024*1024; ++i)
+            log += "INFO request " + std::to_string(i % 1000) + " served\r\n";
+        std::string noise;
+        std::uint32_t state = 1;
+        while (noise.size() < 200*1000) {
+            state = state*1103515245 + 12345;
+            noise += (char)(state >> 16);
+        }
+        for (const std::string* input : {&log, &noise}) {
+            for (std::size_t chunk : {(std::size_t)1000, (std::size_t)100*1000}) {
+                subprocess::BlockCompressor compressor;
+                std::string compressed = apply(compressor, *input, chunk);
+                TS_ASSERT(subprocess::BlockCompressor::decompress(compressed) == *input);
+                std::size_t limit = input == &log ? input->size()/4 : input->size() + 100;
+                TS_ASSERT(compressed.size() < limit);
+            }
+        }
+        subprocess::BlockCompressor compressor;
+        std::string compressed = apply(compressor, log, 4096);
+        compressed.pop_back();
+        TS_ASSERT_THROWS(subprocess::BlockCompressor::decompress(compressed),
+            std::runtime_error);
+        compressed = apply(compressor, log, 4096);
+        // no checksum, but the sizes must add up
+        compressed[0] ^= 1;
+        TS_ASSERT_THROWS(subprocess::BlockCompressor::decompress(compressed),
+            std::runtime_error);
+
+        // through run(), stop patterns see the output before the stages
+        std::string expected;
+        for (int i = 0; i < 1000; ++i)
+            expected += "INFO request " + std::to_string(i) + " served\n";
+        // small enough for the pipe, so stopping cat doesn't break feeding it
+        std::string head = log.substr(0, log.find("INFO request 0 ", 1));
+        auto completed = RunBuilder({"cat"}).cin(head).cout(PipeOption::pipe)
+            .cout_transform(std::make_shared<subprocess::CrlfToLf>())
+            .cout_transform(subprocess::LineFilter::containing("request 999 ", true))
+            .cout_transform(std::make_shared<subprocess::BlockCompressor>())
+            .cerr(PipeOption::pipe).stop_on({"request 999 served\r\n"})
+            .digest(subprocess::kDigestXxh64).run();
+        std::string filtered = expected.substr(0, expected.find("INFO request 999"));
+        TS_ASSERT(subprocess::BlockCompressor::decompress(completed.cout) == filtered);
+        TS_ASSERT_EQUALS(completed.cout_digest.size, completed.cout.size());
+
+        std::size_t lines = 0;
+        auto sink = std::make_shared<subprocess::LineSink>([&](std::string_view) { ++lines; });
+        completed = RunBuilder({"cat"}).cin(log).cout(sink)
+            .cout_transform(subprocess::LineFilter::containing("request 7 ")).run();
+        std::size_t expected_lines = 0;
+        for (std::size_t pos = 0; (pos = log.find("request 7 ", pos)) != std::string::npos; ++pos)
+            ++expected_lines;
+        TS_ASSERT(expected_lines > 0);
+        TS_ASSERT_EQUALS(lines, expected_lines);
+
+        TS_ASSERT_THROWS(RunBuilder({"cat"}).cin(log)
+            .cout_transform(std::make_shared<subprocess::CrlfToLf>()).run(),
+            std::invalid_argument);
+
+        // a stage failing on a FILE* thread still drains the child
+        struct Failing : TransformStage {
+            void transform(char*, std::size_t, const Emit&) override {
+                throw std::runtime_error("stage failed");
+            }
+        };
+        FILE* file = tmpfile();
+        subprocess::Popen failing = RunBuilder({"cat"}).cin(log).cout(file)
+            .cout_transform(std::make_shared<Failing>()).popen();
+        TS_ASSERT_EQUALS(failing.wait(30), 0);
+        failing.close();
+        fclose(file);
+    }
+
+    void testPipeline() {
+        using subprocess::Pipeline;
+        using subprocess::PipeHandle;
+
+        // yes | head -c 1000 | cat, the middle one spliced
+        auto completed = Pipeline().add({"yes", "spliced"})
+            .add(Pipeline::head_bytes(1000))
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run();
+        std::string expected;
+        while (expected.size() < 1000)
+            expected += "spliced\n";
+        expected.resize(1000);
+        TS_ASSERT_EQUALS(completed.cout, expected);
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+
+        // head -n ends an endless producer
+        completed = Pipeline().add({"yes"}).add(Pipeline::head(3))
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run();
+        TS_ASSERT_EQUALS(completed.cout, "y\ny\ny\n");
+
+        // cat | grep -F 77 | cat | wc -l
+        std::string input;
+        std::size_t expected_lines = 0;
+        for (int i = 0; i < 100000; ++i) {
+            std::string line = std::to_string(i);
+            expected_lines += line.find("77") != std::string::npos;
+            input += line + "\n";
+        }
+        std::size_t lines = 0;
+        Pipeline pipeline;
+        pipeline.add(RunBuilder({"cat"}).cin(input))
+            .add(Pipeline::transform({subprocess::LineFilter::containing("77")}))
+            .add({"cat"})
+            .add([&](PipeHandle input, PipeHandle output) {
+                TS_ASSERT_EQUALS(output, subprocess::kBadPipeValue);
+                std::string counted = subprocess::pipe_read_all(input);
+                lines = std::count(counted.begin(), counted.end(), '\n');
+            });
+        pipeline.run();
+        TS_ASSERT_EQUALS(lines, expected_lines);
+        TS_ASSERT_EQUALS(pipeline.processes().size(), 2u);
+        TS_ASSERT_THROWS(pipeline.add({"cat"}), std::runtime_error);
+
+        Pipeline failing;
+        failing.add({"yes"}).add([](PipeHandle, PipeHandle) {
+            throw std::runtime_error("stage failed");
+        });
+        TS_ASSERT_THROWS(failing.run(), std::runtime_error);
+        TS_ASSERT_THROWS(Pipeline().add({"yes"}).add(Pipeline::head(1)).add({"false"})
+            .run(true), subprocess::CalledProcessError);
+        completed = Pipeline().add({"echo", "hi"})
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run(true);
+        TS_ASSERT_EQUALS(completed.cout, "hi\n");
+        TS_ASSERT_EQUALS(completed.returncode, 0);
+
+        // between two plain pipes
+        auto from = subprocess::pipe_create(false);
+        auto to = subprocess::pipe_create(false);
+        subprocess::pipe_write_all(from.output, "hello", 5);
+        from.close_output();
+        TS_ASSERT_EQUALS(subprocess::pipe_splice_all(from.input, to.output), 5u);
+        to.close_output();
+        TS_ASSERT_EQUALS(subprocess::pipe_read_all(to.input), "hello");
+    }
+
 /*
     void tesxtCat() {
         CompletedProcess completed = subprocess::run({"cat"},
@@ -0,0 +1,634 @@
+#include <cstdio>
+#include <ctime>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <subprocess.hpp>
+#include <subprocess/simd.hpp>
+
+#include "monolithic_examples.h"
+
+// Throughput benchmarks for the data paths between parent and child. Pass the
+// names of benchmarks to run as arguments, or nothing to run all of them.
+
+using subprocess::CommandLine;
+using subprocess::CompletedProcess;
+using subprocess::PipeOption;
+using subprocess::RunBuilder;
+
+static double g_megabyte = 1024.0*1024.0;
+
+static void report(const char* name, double bytes, double seconds) {
+    printf("%-32s %10.1f MB %8.3f s %10.1f MB/s\n", name, bytes/g_megabyte,
+        seconds, bytes/g_megabyte/seconds);
+}
+
+static void bench_pinned_cin() {
+    const std::size_t size = 256*1024*1024;
+    std::string data(size, 'x');
+    subprocess::PinnedBuffer pinned(data);
+
+    for (int i = 0; i < 3; ++i) {
+        subprocess::StopWatch watch;
+        CompletedProcess process = subprocess::run({"count"},
+            RunBuilder().cin(data).cout(PipeOption::pipe));
+        report("cin std::string (write)", (double)size, watch.seconds());
+
+        watch.start();
+        process = subprocess::run({"count"},
+            RunBuilder().cin(pinned).cout(PipeOption::pipe));
+        report("cin PinnedBuffer (vmsplice)", (double)size, watch.seconds());
+    }
+}
+
+static void bench_chunk_callback() {
+    // dispatch cost alone, no child involved
+    subprocess::CallbackSink sink([](std::string_view chunk) {
+        volatile char first = chunk[0];
+        (void)first;
+    });
+    const int iterations = 10000000;
+    char chunk[64] = {1};
+    subprocess::StopWatch watch;
+    for (int i = 0; i < iterations; ++i)
+        sink.write(std::string_view(chunk, sizeof(chunk)));
+    double seconds = watch.seconds();
+    printf("%-32s %10.1f ns/chunk\n", "CallbackSink dispatch", seconds*1e9/iterations);
+
+    const std::size_t size = 256*1024*1024;
+    subprocess::PinnedBuffer data(std::string(size, 'x'));
+    for (int i = 0; i < 3; ++i) {
+        watch.start();
+        CompletedProcess process = subprocess::run({"cat"},
+            RunBuilder().cin(data).cout(PipeOption::pipe));
+        report("cout captured", (double)process.cout.size(), watch.seconds());
+
+        std::size_t total = 0;
+        int chunks = 0;
+        watch.start();
+        process = subprocess::run({"cat"}, RunBuilder().cin(data)
+            .cout([&](std::string_view chunk) {
+                total += chunk.size();
+                ++chunks;
+            }));
+        seconds = watch.seconds();
+        report("cout ChunkCallback", (double)total, seconds);
+        printf("%-32s %10d chunks %8.1f us/chunk\n", "", chunks, seconds*1e6/chunks);
+    }
+}
+
+static void bench_line_sink() {
+    // 100 byte lines including the newline, fed in 64KB chunks like run() does
+    std::string data;
+    while (data.size() < 256*1024*1024)
+        data += std::string(99, 'a' + data.size() % 26) + "\n";
+    const std::size_t chunk_size = 64*1024;
+    using subprocess::details::SimdLevel;
+    const char* names[] = {"LineSink scalar", "LineSink sse2", "LineSink avx2"};
+
+    for (SimdLevel level : {SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2}) {
+        if (level > subprocess::details::simd_level())
+            continue;
+        // same loop as LineSink::write() with the level forced
+        std::size_t lines = 0;
+        subprocess::StopWatch watch;
+        const char* pos = data.data();
+        const char* end = pos + data.size();
+        while (pos < end) {
+            const char* newline = subprocess::details::find_byte(pos, end, '\n', level);
+            ++lines;
+            pos = newline + 1;
+        }
+        report(names[(int)level], (double)data.size(), watch.seconds());
+    }
+
+    std::size_t lines = 0;
+    subprocess::LineSink sink([&](std::string_view /*line*/) { ++lines; });
+    subprocess::StopWatch watch;
+    for (std::size_t pos = 0; pos < data.size(); pos += chunk_size)
+        sink.write(std::string_view(data).substr(pos, chunk_size));
+    sink.finish();
+    report("LineSink (dispatched)", (double)data.size(), watch.seconds());
+
+    lines = 0;
+    watch.start();
+    std::istringstream stream(data);
+    std::string line;
+    while (std::getline(stream, line))
+        ++lines;
+    report("std::getline", (double)data.size(), watch.seconds());
+}
+
+static void bench_memory_capture() {
+    for (std::size_t size : {(std::size_t)10*1024*1024, (std::size_t)1024*1024*1024}) {
+        std::string bytes = std::to_string(size);
+        for (int i = 0; i < 3; ++i) {
+            subprocess::StopWatch watch;
+            CompletedProcess process = subprocess::run({"stdioblaster", bytes},
+                RunBuilder().cout(PipeOption::pipe));
+            report("cout pipe capture", (double)process.cout.size(), watch.seconds());
+
+            watch.start();
+            auto capture = std::make_shared<subprocess::MemoryCapture>();
+            subprocess::run({"stdioblaster", bytes}, RunBuilder().cout(capture));
+            std::string_view view = capture->view();
+            report("cout MemoryCapture", (double)view.size(), watch.seconds());
+        }
+    }
+}
+
+static void bench_broadcast() {
+    const std::size_t size = 256*1024*1024;
+    const int children = 4;
+    std::string data(size, 'x');
+    auto run_all = [&](std::vector<subprocess::Popen>& popens) {
+        for (auto& popen : popens) {
+            CompletedProcess process = subprocess::run(popen);
+            if (std::stoull(process.cout) != size)
+                printf("child only got %s", process.cout.c_str());
+        }
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        subprocess::StopWatch watch;
+        std::vector<subprocess::Popen> popens;
+        for (int child = 0; child < children; ++child)
+            popens.push_back(RunBuilder({"count"}).cin(data).cout(PipeOption::pipe).popen());
+        run_all(popens);
+        report("4x cin std::string", (double)size*children, watch.seconds());
+
+        watch.start();
+        popens.clear();
+        auto broadcast = std::make_shared<subprocess::Broadcast>(data);
+        for (int child = 0; child < children; ++child)
+            popens.push_back(RunBuilder({"count"}).cin(broadcast).cout(PipeOption::pipe).popen());
+        broadcast->start();
+        run_all(popens);
+        broadcast->wait();
+        report("4x Broadcast memory", (double)size*children, watch.seconds());
+
+        watch.start();
+        popens.clear();
+        auto producer = RunBuilder({"stdioblaster", std::to_string(size)})
+            .cout(PipeOption::pipe).popen();
+        auto teed = std::make_shared<subprocess::Broadcast>(producer.cout);
+        for (int child = 0; child < children; ++child)
+            popens.push_back(RunBuilder({"count"}).cin(teed).cout(PipeOption::pipe).popen());
+        teed->start();
+        run_all(popens);
+        teed->wait();
+        producer.close();
+        report("4x Broadcast pipe (tee)", (double)size*children, watch.seconds());
+    }
+}
+
+static void bench_sharder() {
+    // cat as the worker, measures the scatter/gather overhead
+    std::string data;
+    while (data.size() < 256*1024*1024)
+        data += std::string(99, 'a' + data.size() % 26) + "\n";
+    printf("%d cpus\n", (int)std::thread::hardware_concurrency());
+
+    for (int workers : {1, 2, 4, 8}) {
+        for (bool ordered : {false, true}) {
+            subprocess::ShardOptions options;
+            options.workers = workers;
+            options.ordered = ordered;
+            subprocess::StopWatch watch;
+            CompletedProcess process = subprocess::run_sharded({"cat"}, data, options);
+            double seconds = watch.seconds();
+            if (process.cout.size() != data.size())
+                printf("lost output, got %zu bytes\n", process.cout.size());
+            char name[64];
+            snprintf(name, sizeof(name), "%d workers %s", workers,
+                ordered? "ordered" : "unordered");
+            report(name, (double)data.size(), seconds);
+        }
+    }
+}
+
+static void bench_merged_output() {
+    // 500 children writing 64 byte lines as fast as they can
+    const int children = 500;
+    const std::size_t size = 2*1024*1024;
+    std::size_t total = 0;
+    std::size_t lines = 0;
+    auto counter = std::make_shared<subprocess::CallbackSink>([&](std::string_view chunk) {
+        total += chunk.size();
+        for (char ch : chunk)
+            lines += ch == '\n';
+    });
+
+    subprocess::StopWatch watch;
+    {
+        subprocess::MergedOutput merged(counter);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < children; ++i) {
+            auto sink = merged.sink("child-" + std::to_string(i) + " | ");
+            threads.emplace_back([sink, size]() {
+                RunBuilder({"stdioblaster", std::to_string(size)}).cout(sink).run();
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+    }
+    double seconds = watch.seconds();
+    report("500 children merged", (double)size*children, seconds);
+    printf("%-32s %10zu lines %10.1f Mlines/s, %zu bytes with tags\n", "",
+        lines, lines/seconds/1e6, total);
+}
+
+static void bench_expect() {
+    // many sessions driven round robin from one thread, each exchange
+    // matches one of several prompts in a 4KB reply
+    const int sessions = 200;
+    const int rounds = 100;
+    std::vector<std::unique_ptr<subprocess::Expect>> cats;
+    for (int i = 0; i < sessions; ++i)
+        cats.push_back(std::make_unique<subprocess::Expect>(CommandLine{"cat"}));
+    std::string request(4096 - 8, 'x');
+    request += "\nREADY> ";
+    std::vector<std::string> prompts = {"ERROR> ", "MORE> ", "READY> "};
+
+    std::clock_t cpu = std::clock();
+    subprocess::StopWatch watch;
+    for (int round = 0; round < rounds; ++round) {
+        for (auto& cat : cats)
+            cat->send(request);
+        for (auto& cat : cats) {
+            if (cat->expect(prompts, 10).index != 2)
+                throw std::runtime_error("bench_expect: wrong prompt");
+        }
+    }
+    double seconds = watch.seconds();
+    double cpu_seconds = (double)(std::clock() - cpu)/CLOCKS_PER_SEC;
+    double exchanges = (double)sessions*rounds;
+    report("200 expect sessions", exchanges*request.size(), seconds);
+    printf("%-32s %10.0f exchanges/s, %.1f us parent cpu each\n", "",
+        exchanges/seconds, cpu_seconds/exchanges*1e6);
+}
+
+#ifndef _WIN32
+/*  Sends a 64 byte request to cat and waits for the reply, one at a time,
+    over separate cin & cout channels of the given kind.
+*/
+static double round_trip_seconds(PipeOption option, int rounds) {
+    subprocess::Popen cat = RunBuilder({"cat"}).cin(option).cout(option).popen();
+    char request[64];
+    memset(request, 'r', sizeof(request));
+    char reply[64];
+    subprocess::StopWatch watch;
+    for (int i = 0; i < rounds; ++i) {
+        subprocess::pipe_write(cat.cin, request, sizeof(request));
+        std::size_t received = 0;
+        while (received < sizeof(reply)) {
+            ssize_t transfered = subprocess::pipe_read(cat.cout, reply + received,
+                sizeof(reply) - received);
+            if (transfered <= 0)
+                throw std::runtime_error("round_trip_seconds: cat went away");
+            received += transfered;
+        }
+    }
+    double seconds = watch.seconds();
+    cat.close_cin();
+    cat.wait();
+    return seconds;
+}
+
+static void bench_socketpair() {
+    const int rounds = 20000;
+    double pipe_seconds = round_trip_seconds(PipeOption::pipe, rounds);
+    double socket_seconds = round_trip_seconds(PipeOption::socketpair, rounds);
+    printf("%-32s %10.2f us round trip\n", "pipe pair", pipe_seconds/rounds*1e6);
+    printf("%-32s %10.2f us round trip\n", "socketpair", socket_seconds/rounds*1e6);
+}
+#endif
+
+#ifdef __linux__
+/*  Streams size bytes through cat_child over pipes and through ring_child
+    over shared memory rings, then ping-pongs 64 byte messages.
+*/
+static void bench_shm_ring() {
+    const std::size_t size = 512*1024*1024;
+    const std::size_t chunk = 64*1024;
+    std::vector<char> data(chunk, 'x');
+    std::vector<char> buffer(chunk);
+    {
+        subprocess::Popen cat = RunBuilder({"cat"}).cin(PipeOption::pipe)
+            .cout(PipeOption::pipe).popen();
+        subprocess::StopWatch watch;
+        std::thread feeder([&]() {
+            for (std::size_t sent = 0; sent < size; sent += chunk)
+                subprocess::pipe_write(cat.cin, &data[0], chunk);
+            cat.close_cin();
+        });
+        std::size_t received = 0;
+        while (true) {
+            ssize_t transfered = subprocess::pipe_read(cat.cout, &buffer[0], buffer.size());
+            if (transfered <= 0)
+                break;
+            received += transfered;
+        }
+        feeder.join();
+        report("pipes through cat", (double)received, watch.seconds());
+        cat.wait();
+    }
+    {
+        subprocess::ShmChannel to_child;
+        subprocess::ShmChannel from_child;
+        subprocess::RunOptions options;
+        to_child.pass_to(options, 3);
+        from_child.pass_to(options, 6);
+        subprocess::Popen child({"ring_child"}, options);
+        auto reader = from_child.reader();
+        subprocess::StopWatch watch;
+        std::thread feeder([&]() {
+            auto writer = to_child.writer();
+            for (std::size_t sent = 0; sent < size; sent += chunk)
+                writer.write(&data[0], chunk);
+        });
+        std::size_t received = 0;
+        while (true) {
+            std::string_view view = reader.peek();
+            if (view.empty())
+                break;
+            received += view.size();
+            reader.consume(view.size());
+        }
+        feeder.join();
+        report("rings through ring_child", (double)received, watch.seconds());
+        child.wait();
+    }
+
+    const int rounds = 20000;
+    double pipe_seconds = round_trip_seconds(PipeOption::pipe, rounds);
+    double ring_seconds;
+    {
+        subprocess::ShmChannel to_child;
+        subprocess::ShmChannel from_child;
+        subprocess::RunOptions options;
+        to_child.pass_to(options, 3);
+        from_child.pass_to(options, 6);
+        subprocess::Popen child({"ring_child"}, options);
+        auto writer = to_child.writer();
+        auto reader = from_child.reader();
+        char request[64];
+        memset(request, 'r', sizeof(request));
+        subprocess::StopWatch watch;
+        for (int i = 0; i < rounds; ++i) {
+            writer.write(request, sizeof(request));
+            std::size_t received = 0;
+            while (received < sizeof(request))
+                received += reader.read(&buffer[0], sizeof(request) - received);
+        }
+        ring_seconds = watch.seconds();
+        writer.close();
+        while (reader.read(&buffer[0], buffer.size()) > 0) {
+        }
+        child.wait();
+    }
+    printf("%-32s %10.2f us round trip\n", "pipe pair", pipe_seconds/rounds*1e6);
+    printf("%-32s %10.2f us round trip\n", "shm rings", ring_seconds/rounds*1e6);
+}
+#endif
+
+static void bench_framed_channel() {
+    // 100 byte requests echoed by cat, one at a time and pipelined
+    const int requests = 100000;
+    std::string request(100, 'q');
+    for (int window : {1, 16, 256}) {
+        subprocess::Popen cat = RunBuilder({"cat"}).cin(PipeOption::pipe)
+            .cout(PipeOption::pipe).popen();
+        subprocess::FramedChannel channel(cat);
+        std::string_view reply;
+        subprocess::StopWatch watch;
+        for (int sent = 0; sent < requests; sent += window) {
+            for (int i = 0; i < window; ++i)
+                channel.send(request);
+            channel.flush();
+            for (int i = 0; i < window; ++i)
+                channel.receive(reply);
+        }
+        double seconds = watch.seconds();
+        channel.close();
+        cat.wait();
+        std::string name = "framed, " + std::to_string(window) + " in flight";
+        printf("%-32s %10.0f requests/s\n", name.c_str(), requests/seconds);
+    }
+}
+
+static void bench_fan_out() {
+    // cout captured and fed to a second child, 256MB
+    const std::string size = std::to_string(256*1024*1024);
+    for (int i = 0; i < 2; ++i) {
+        subprocess::StopWatch watch;
+        CompletedProcess process = subprocess::run({"stdioblaster", size},
+            RunBuilder().cout(PipeOption::pipe));
+        subprocess::Popen count = RunBuilder({"count"}).cin(PipeOption::pipe)
+            .cout(PipeOption::pipe).popen();
+        subprocess::pipe_write_all(count.cin, process.cout.data(), process.cout.size());
+        count.close_cin();
+        subprocess::run(count);
+        report("capture, then write", (double)process.cout.size(), watch.seconds());
+
+        for (bool tee : {false, true}) {
+            watch.start();
+            count = RunBuilder({"count"}).cin(PipeOption::pipe)
+                .cout(PipeOption::pipe).popen();
+            auto fan = std::make_shared<subprocess::FanOutSink>();
+            fan->capture();
+            subprocess::PipeHandle handle = count.cin;
+            if (tee) {
+                fan->add(handle);
+            } else {
+                fan->add([handle](std::string_view chunk) {
+                    subprocess::pipe_write_all(handle, chunk.data(), chunk.size());
+                });
+            }
+            process = subprocess::run({"stdioblaster", size}, RunBuilder().cout(fan));
+            count.close_cin();
+            subprocess::run(count);
+            report(tee? "FanOutSink tee" : "FanOutSink write",
+                (double)process.cout.size(), watch.seconds());
+        }
+    }
+}
+
+static void bench_digest() {
+    std::string data(64*1024*1024, '\0');
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = (char)(i*131 + (i >> 12));
+    subprocess::StopWatch watch;
+    volatile std::uint32_t crc = subprocess::details::crc32c(data.data(), data.size(), 0, false);
+    report("crc32c table", (double)data.size(), watch.seconds());
+    if (subprocess::details::crc32c_hardware()) {
+        watch.start();
+        crc = subprocess::details::crc32c(data.data(), data.size(), 0, true);
+        report("crc32c sse4.2", (double)data.size(), watch.seconds());
+    }
+    watch.start();
+    subprocess::Xxh64 hash;
+    hash.update(data);
+    volatile std::uint64_t xxh64 = hash.digest();
+    report("xxh64", (double)data.size(), watch.seconds());
+    (void)crc;
+    (void)xxh64;
+
+    // 1GB of output captured and hashed, after the fact or while read
+    const std::string size = std::to_string(1024*1024*1024);
+    const int kinds = subprocess::kDigestCrc32c | subprocess::kDigestXxh64;
+    for (int i = 0; i < 2; ++i) {
+        watch.start();
+        CompletedProcess process = subprocess::run({"stdioblaster", size},
+            RunBuilder().cout(PipeOption::pipe));
+        report("capture", (double)process.cout.size(), watch.seconds());
+
+        watch.start();
+        process = subprocess::run({"stdioblaster", size}, RunBuilder().cout(PipeOption::pipe));
+        crc = subprocess::crc32c(process.cout);
+        subprocess::Xxh64 after;
+        after.update(process.cout);
+        xxh64 = after.digest();
+        report("capture, then digest", (double)process.cout.size(), watch.seconds());
+
+        watch.start();
+        process = subprocess::run({"stdioblaster", size},
+            RunBuilder().cout(PipeOption::pipe).digest(kinds));
+        report("capture, digest inline", (double)process.cout.size(), watch.seconds());
+
+        watch.start();
+        process = subprocess::run({"stdioblaster", size},
+            RunBuilder().cout(PipeOption::devnull).digest(kinds));
+        report("devnull, digest inline", (double)process.cout_digest.size, watch.seconds());
+    }
+}
+
+static void bench_transform() {
+    std::string log;
+    for (int i = 0; log.size() < 64*1024*1024; ++i)
+        log += "INFO request " + std::to_string(i) + " served in " + std::to_string(i % 97) + "ms\n";
+    for (int i = 0; i < 2; ++i) {
+        subprocess::StopWatch watch;
+        CompletedProcess process = subprocess::run({"sh", "-c", "cat | grep -F 'in 7ms'"},
+            RunBuilder().cin(log).cout(PipeOption::pipe));
+        report("| grep -F", (double)log.size(), watch.seconds());
+        std::size_t grepped = process.cout.size();
+
+        watch.start();
+        process = subprocess::run({"cat"}, RunBuilder().cin(log).cout(PipeOption::pipe)
+            .cout_transform(subprocess::LineFilter::containing("in 7ms")));
+        report("LineFilter", (double)log.size(), watch.seconds());
+        if (process.cout.size() != grepped)
+            printf("  LineFilter kept %zu bytes, grep %zu\n", process.cout.size(), grepped);
+
+        watch.start();
+        process = subprocess::run({"sh", "-c", "cat | gzip -1"},
+            RunBuilder().cin(log).cout(PipeOption::pipe));
+        report("| gzip -1", (double)log.size(), watch.seconds());
+        printf("  ratio %.2f\n", (double)log.size()/process.cout.size());
+
+        watch.start();
+        process = subprocess::run({"cat"}, RunBuilder().cin(log).cout(PipeOption::pipe)
+            .cout_transform(std::make_shared<subprocess::BlockCompressor>()));
+        report("BlockCompressor", (double)log.size(), watch.seconds());
+        printf("  ratio %.2f\n", (double)log.size()/process.cout.size());
+    }
+}
+
+static void bench_pipeline() {
+    using subprocess::Pipeline;
+    std::string log;
+    for (int i = 0; log.size() < 64*1024*1024; ++i)
+        log += "INFO request " + std::to_string(i) + " served in " + std::to_string(i % 97) + "ms\n";
+    const std::string size = std::to_string(log.size());
+    for (int i = 0; i < 2; ++i) {
+        subprocess::StopWatch watch;
+        CompletedProcess process = Pipeline().add(RunBuilder({"cat"}).cin(log))
+            .add({"grep", "-F", "in 7ms"})
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run();
+        report("cat | grep -F | cat", (double)log.size(), watch.seconds());
+
+        watch.start();
+        process = Pipeline().add(RunBuilder({"cat"}).cin(log))
+            .add(Pipeline::transform({subprocess::LineFilter::containing("in 7ms")}))
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run();
+        report("cat | LineFilter | cat", (double)log.size(), watch.seconds());
+
+        // everything passes, what's measured is the hop
+        watch.start();
+        process = Pipeline().add(RunBuilder({"cat"}).cin(log))
+            .add({"head", "-c", size})
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run();
+        report("cat | head -c | cat", (double)process.cout.size(), watch.seconds());
+
+        watch.start();
+        process = Pipeline().add(RunBuilder({"cat"}).cin(log))
+            .add(Pipeline::head_bytes(log.size()))
+            .add(RunBuilder({"cat"}).cout(PipeOption::pipe)).run();
+        report("cat | head_bytes | cat", (double)process.cout.size(), watch.seconds());
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+static Benchmark g_benchmarks[] = {
+    {"pinned_cin",      bench_pinned_cin},
+    {"chunk_callback",  bench_chunk_callback},
+    {"line_sink",       bench_line_sink},
+    {"memory_capture",  bench_memory_capture},
+    {"broadcast",       bench_broadcast},
+    {"sharder",         bench_sharder},
+    {"merged_output",   bench_merged_output},
+    {"expect",          bench_expect},
+#ifndef _WIN32
+    {"socketpair",      bench_socketpair},
+#endif
+#ifdef __linux__
+    {"shm_ring",        bench_shm_ring},
+#endif
+    {"framed_channel",  bench_framed_channel},
+    {"fan_out",         bench_fan_out},
+    {"digest",          bench_digest},
+    {"transform",       bench_transform},
+    {"pipeline",        bench_pipeline},
+};
+
+static std::string dirname(std::string path) {
+    size_t slash_pos = path.size();
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] == '/' || path[i] == '\\')
+            slash_pos = i;
+    }
+    return path.substr(0, slash_pos);
+}
+
+#if defined(BUILD_MONOLITHIC)
+#define main(cnt, arr)      subproc_benchmark_main(cnt, arr)
+#endif
+
+int main(int argc, const char** argv)
+{
+    // the test children live next to us
+    std::string path = subprocess::cenv["PATH"];
+    path = dirname(subprocess::abspath(argv[0])) + subprocess::kPathDelimiter + path;
+    subprocess::cenv["PATH"] = path;
+
+    for (auto& benchmark : g_benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], benchmark.name) == 0)
+                selected = true;
+        }
+        if (!selected)
+            continue;
+        printf("== %s\n", benchmark.name);
+        benchmark.run();
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <cstdio>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "monolithic_examples.h"
+
+// Reads stdin until end of file and prints how many bytes it got. Used as a
+// fast consumer so benchmarks measure the feeding side and not the child.
+
+#if defined(BUILD_MONOLITHIC)
+#define main(cnt, arr)      subproc_count_main(cnt, arr)
+#endif
+
+int main(int, const char**)
+{
+    std::vector<char> buffer(1 << 16);
+    unsigned long long total = 0;
+    while (true) {
+        auto transfered = read(0, &buffer[0], (unsigned)buffer.size());
+        if (transfered <= 0)
+            break;
+        total += transfered;
+    }
+    printf("%llu\n", total);
+    return 0;
+}
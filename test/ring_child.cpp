@@ -0,0 +1,29 @@
+#include <subprocess/ShmRing.hpp>
+
+#include "monolithic_examples.h"
+
+// Copies everything from the ShmChannel on fds 3-5 to the one on fds 6-8,
+// cat over shared memory rings.
+
+#if defined(BUILD_MONOLITHIC)
+#define main(cnt, arr)      subproc_ring_child_main(cnt, arr)
+#endif
+
+int main(int, const char**)
+{
+#ifdef __linux__
+    auto reader = subprocess::shm::RingReader::from_fds(3);
+    auto writer = subprocess::shm::RingWriter::from_fds(6);
+    while (true) {
+        std::string_view data = reader.peek();
+        if (data.empty())
+            break;
+        writer.write(data);
+        reader.consume(data.size());
+    }
+    writer.close();
+    return 0;
+#else
+    return 1;
+#endif
+}
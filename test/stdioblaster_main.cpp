@@ -1,5 +1,15 @@
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
+#include <chrono>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
 #include <subprocess.hpp>
 
 #include "monolithic_examples.h"
@@ -17,21 +27,41 @@
 
 int main(int argc, const char** argv)
 {
-	// TODO
-	
-	
-	
-	
-    bool print_space = false;
+    // stdioblaster <bytes>: writes that many bytes of text as fast as it
+    // can, to stderr when USE_CERR=1.
+    // stdioblaster --interleave <lines>: alternates lines between stdout
+    // and stderr, pausing in between so the order is observable.
+    // stdioblaster --fd <fd> <text>: writes text to fd, fails if it's not
+    // open.
+    if (argc > 3 && strcmp(argv[1], "--fd") == 0) {
+        int fd = atoi(argv[2]);
+        int size = (int)strlen(argv[3]);
+        return write(fd, argv[3], size) == size? 0 : 1;
+    }
+    if (argc > 2 && strcmp(argv[1], "--interleave") == 0) {
+        int lines = atoi(argv[2]);
+        for (int i = 0; i < lines; ++i) {
+            FILE* file = i % 2? stderr : stdout;
+            fprintf(file, "%s %d\n", i % 2? "cerr" : "cout", i);
+            fflush(file);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return 0;
+    }
+    unsigned long long remaining = argc > 1? strtoull(argv[1], nullptr, 10) : 0;
     std::string use_cerr_str = subprocess::cenv["USE_CERR"];
     bool use_cerr = use_cerr_str == "1";
     auto output_file = use_cerr? stderr : stdout;
-    for (int i = 1; i < argc; ++i) {
-        if (print_space)
-            fwrite(" ", 1, 1, output_file);
-        fwrite(argv[i], 1, strlen(argv[i]), output_file);
-        print_space = true;
+
+    std::vector<char> buffer(1 << 16);
+    for (std::size_t i = 0; i < buffer.size(); ++i)
+        buffer[i] = (i % 64) == 63? '\n' : 'a' + (char)(i % 26);
+    while (remaining > 0) {
+        std::size_t chunk = remaining < buffer.size()? (std::size_t)remaining : buffer.size();
+        if (fwrite(&buffer[0], 1, chunk, output_file) != chunk)
+            return 1;
+        remaining -= chunk;
     }
-    fwrite("\n", 1, 1, output_file);
+    fflush(output_file);
     return 0;
 }